@@ -5,14 +5,20 @@
 #include <algorithm>
 #include <chrono>
 #include <cmath>
+#include <cstddef>
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <format>
 #include <limits>
+#include <memory_resource>
 #include <print>
+#include <span>
 #include <string>
 #include <vector>
 
+#include "stats.hpp"
+
 template <typename T>
 constexpr T infinity_v = std::numeric_limits<T>::infinity();
 template <typename T>
@@ -21,6 +27,7 @@ template <typename T>
 constexpr T min_v = std::numeric_limits<T>::lowest();
 
 using index_t = uint32_t;
+constexpr index_t invalid_index = max_v<index_t>;
 
 struct timer {
   using clock_t = std::chrono::steady_clock;
@@ -46,7 +53,13 @@ struct scope_timer : timer {
   const char *name;
 };
 
+// prints how long the enclosing function took. Benchmarks define
+// BVH_NO_TRACE, they time the functions themselves.
+#ifdef BVH_NO_TRACE
+#define TRACE
+#else
 #define TRACE scope_timer __scope_timer__(__FUNCTION__);
+#endif
 
 uint32_t inline random_uint(uint32_t &seed) {
   seed ^= (seed << 13);
@@ -141,10 +154,68 @@ inline float3 max(const float3 &a, const float3 &b) {
 
 // end float3
 
+// 64-bit fnv-1a over 8 byte words and the remaining bytes one by one,
+// continues from seed. Only meant to notice changed data.
+uint64_t inline fnv1a(const void *data, size_t size,
+                      uint64_t seed = 0xcbf29ce484222325ull) {
+  const auto *bytes = static_cast<const unsigned char *>(data);
+  size_t i = 0;
+  for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+    uint64_t word;
+    std::memcpy(&word, bytes + i, sizeof(word));
+    seed ^= word;
+    seed *= 0x100000001b3ull;
+  }
+  for (; i < size; ++i) {
+    seed ^= bytes[i];
+    seed *= 0x100000001b3ull;
+  }
+  return seed;
+}
+
 struct triangle {
-  float3 vertex0, vertex1, vertex2, centroid;
+  float3 vertex0, vertex1, vertex2;
 };
 using triangle_list = std::vector<triangle>;
+static_assert(sizeof(triangle) == 3 * sizeof(float3));
+
+// triangles of an indexed mesh, vertex k of triangle i is the float3 at
+// vertices + indices[3 * i + k] * stride bytes. Without indices every three
+// consecutive vertices form a triangle. The buffers are not owned.
+struct mesh_view {
+  mesh_view() = default;
+  mesh_view(std::span<const float3> vertices, std::span<const uint32_t> indices)
+      : mesh_view(vertices.data(), sizeof(float3), indices) {}
+  // stride is the distance of two vertices in bytes, so vertices can sit
+  // inside a larger vertex struct
+  mesh_view(const void *vertices, size_t stride,
+            std::span<const uint32_t> indices)
+      : vertices(static_cast<const std::byte *>(vertices)),
+        stride(stride),
+        indices(indices),
+        count(indices.size() / 3) {}
+  explicit mesh_view(std::span<const float3> vertices)
+      : vertices(reinterpret_cast<const std::byte *>(vertices.data())),
+        count(vertices.size() / 3) {}
+  explicit mesh_view(const triangle_list &triangles)
+      : vertices(reinterpret_cast<const std::byte *>(triangles.data())),
+        count(triangles.size()) {}
+
+  index_t size() const { return count; }
+
+  const float3 &vertex(index_t tri, int k) const {
+    index_t v = indices.empty() ? 3 * tri + k : indices[3 * tri + k];
+    return *reinterpret_cast<const float3 *>(vertices + v * stride);
+  }
+  triangle operator[](index_t tri) const {
+    return {vertex(tri, 0), vertex(tri, 1), vertex(tri, 2)};
+  }
+
+  const std::byte *vertices = nullptr;
+  size_t stride = sizeof(float3);
+  std::span<const uint32_t> indices;
+  index_t count = 0;
+};
 
 struct ray {
   ray(float3 origin, float3 direction)
@@ -153,6 +224,14 @@ struct ray {
         r_direction(1 / direction.x, 1 / direction.y, 1 / direction.z) {}
   float3 origin, direction, r_direction;
   float t = 1e30f;
+  // hit record, only written when a closer hit is found
+  float u = 0, v = 0;            // barycentrics of the hit point
+  index_t prim = invalid_index;  // original index of the triangle hit
+  index_t instance = invalid_index;  // instance hit, see tlas
+#ifdef BVH_STATS
+  // occlusion queries take the ray as const and still count
+  mutable ray_stats stats;
+#endif
 };
 
 struct aabb {
@@ -162,8 +241,8 @@ struct aabb {
   }
 
   void grow(const aabb &b) {
-    grow(b.min);
-    grow(b.max);
+    min = ::min(min, b.min);
+    max = ::max(max, b.max);
   }
 
   float area() const {
@@ -237,13 +316,51 @@ struct alignas(32) bvh_node {
   }
 };
 
-void inline intersect_tri(const triangle &t, ray &r) {
+struct build_options {
+  bool parallel = false;  // build sibling subtrees as concurrent tasks
+  // store leaf ordered tri_accel records, see bvh::intersect
+  bool precompute_triangles = false;
+  // store leaves as simd blocks of leaf_block, see bvh::intersect
+  bool simd_leaves = false;
+  // the sah builders cost a leaf as if it was padded to a multiple of this.
+  // 0 picks simd_width with simd_leaves and 1 otherwise.
+  index_t leaf_granularity = 0;
+};
+
+// per triangle data only the builders need. It lives in the build arena,
+// which is released in one go when bvh::build returns.
+struct build_input {
+  mesh_view mesh;  // the vertices, for builders that clip triangles
+  // not thread safe, strategies only allocate from it outside parallel tasks
+  std::pmr::memory_resource* arena;
+  std::pmr::vector<aabb> bounds;
+  std::pmr::vector<float3> centroids;
+};
+
+// triangles a leaf of count triangles is intersected as
+index_t inline padded_count(index_t count, index_t granularity) {
+  return (count + granularity - 1) / granularity * granularity;
+}
+
+// rays closer to the triangle plane than this cosine of the angle to its
+// normal are culled as parallel. Being relative to the triangle, small
+// triangles are hit like large ones, and every triangle kernel culls the same.
+constexpr float parallel_cos = 1e-4f;
+
+// det of moller-trumbore is -dot(d, n) with n = cross(e1, e2), for a unit
+// direction |n| times the cosine. Compared squared to spare the square root.
+bool inline is_parallel(float det, const float3 &n) {
+  return det * det <= parallel_cos * parallel_cos * dot(n, n);
+}
+
+void inline intersect_tri(const triangle &t, ray &r,
+                          index_t prim = invalid_index) {
   float3 e1 = t.vertex1 - t.vertex0;
   float3 e2 = t.vertex2 - t.vertex0;
   float3 p = cross(r.direction, e2);
 
   float det = dot(e1, p);
-  if (std::abs(det) < 1e-4f) return;
+  if (is_parallel(det, cross(e1, e2))) return;
 
   float inv_det = 1 / det;
   float3 tvec = r.origin - t.vertex0;
@@ -256,6 +373,97 @@ void inline intersect_tri(const triangle &t, ray &r) {
   if (v < 0 || u + v > 1) return;
 
   float tt = dot(e2, q) * inv_det;
-  if (tt > 1e-4f) r.t = std::min(r.t, tt);
-  // std::println("t: {}", r.t);
+  if (tt > 1e-4f && tt < r.t) {
+    r.t = tt;
+    r.u = u;
+    r.v = v;
+    r.prim = prim;
+  }
+}
+
+// any hit in front of r.t, used by occlusion queries
+bool inline occluded_tri(const triangle &t, const ray &r) {
+  float3 e1 = t.vertex1 - t.vertex0;
+  float3 e2 = t.vertex2 - t.vertex0;
+  float3 p = cross(r.direction, e2);
+
+  float det = dot(e1, p);
+  if (is_parallel(det, cross(e1, e2))) return false;
+
+  float inv_det = 1 / det;
+  float3 tvec = r.origin - t.vertex0;
+
+  float u = dot(tvec, p) * inv_det;
+  if (u < 0 || u > 1) return false;
+
+  float3 q = cross(tvec, e1);
+  float v = dot(r.direction, q) * inv_det;
+  if (v < 0 || u + v > 1) return false;
+
+  float tt = dot(e2, q) * inv_det;
+  return tt > 1e-4f && tt < r.t;
+}
+
+// triangle stored as the transform from world space into its unit triangle
+// space (Woop et al. 2004), where vertex0 is the origin and the edges map to
+// the x and y axis. A ray test is then three plane evaluations.
+struct alignas(16) tri_accel {
+  tri_accel() = default;
+  tri_accel(const triangle &t, index_t prim) : prim(prim) {
+    float3 e1 = t.vertex1 - t.vertex0;
+    float3 e2 = t.vertex2 - t.vertex0;
+    float3 n = cross(e1, e2);
+    float det = dot(e1, cross(e2, n));
+    // degenerate triangles keep all planes at zero and are never hit
+    if (det == 0) return;
+
+    float inv_det = 1 / det;
+    row0 = cross(e2, n) * inv_det;
+    row1 = cross(n, e1) * inv_det;
+    row2 = cross(e1, e2) * inv_det;
+    d0 = -dot(row0, t.vertex0);
+    d1 = -dot(row1, t.vertex0);
+    d2 = -dot(row2, t.vertex0);
+    // row2 is n / |n|^2, so the is_parallel test of a ray becomes
+    // dz^2 <= parallel_cos^2 / |n|^2
+    parallel_dz2 = parallel_cos * parallel_cos * dot(row2, row2);
+  }
+
+  float3 row0{0}, row1{0}, row2{0};
+  float d0 = 0, d1 = 0, d2 = 0;
+  float parallel_dz2 = 0;
+  index_t prim = invalid_index;
+};
+
+void inline intersect_tri(const tri_accel &t, ray &r) {
+  float oz = dot(t.row2, r.origin) + t.d2;
+  float dz = dot(t.row2, r.direction);
+  if (dz * dz <= t.parallel_dz2) return;
+  float tt = -oz / dz;
+  if (!(tt > 1e-4f && tt < r.t)) return;
+
+  float u = dot(t.row0, r.origin) + t.d0 + tt * dot(t.row0, r.direction);
+  if (u < 0 || u > 1) return;
+
+  float v = dot(t.row1, r.origin) + t.d1 + tt * dot(t.row1, r.direction);
+  if (v < 0 || u + v > 1) return;
+
+  r.t = tt;
+  r.u = u;
+  r.v = v;
+  r.prim = t.prim;
+}
+
+bool inline occluded_tri(const tri_accel &t, const ray &r) {
+  float oz = dot(t.row2, r.origin) + t.d2;
+  float dz = dot(t.row2, r.direction);
+  if (dz * dz <= t.parallel_dz2) return false;
+  float tt = -oz / dz;
+  if (!(tt > 1e-4f && tt < r.t)) return false;
+
+  float u = dot(t.row0, r.origin) + t.d0 + tt * dot(t.row0, r.direction);
+  if (u < 0 || u > 1) return false;
+
+  float v = dot(t.row1, r.origin) + t.d1 + tt * dot(t.row1, r.direction);
+  return v >= 0 && u + v <= 1;
 }
\ No newline at end of file
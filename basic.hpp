@@ -1,19 +1,26 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <string_view>
 #include <vector>
 
 #include "base.hpp"
+#include "parallel.hpp"
 
 struct middle_point {
-  middle_point(triangle_list& tris, std::vector<bvh_node>& nodes,
-               std::vector<index_t>& indices)
-      : triangles(tris), nodes(nodes), indices(indices) {}
+  static constexpr std::string_view name = "middle_point";
+
+  middle_point(const build_input& input, std::vector<bvh_node>& nodes,
+               std::vector<index_t>& indices, const build_options& options)
+      : input(input), nodes(nodes), indices(indices), options(options) {}
 
   void split(index_t node_idx) {
     auto& node = nodes[node_idx];
-    if (node.tri_count <= 2) return;
-
     update_bounds(node_idx);
+    if (node.tri_count <= std::max<index_t>(2, options.leaf_granularity)) {
+      return;
+    }
 
     // compute split axis and position
     float3 extent = node.bounds.max - node.bounds.min;
@@ -26,27 +33,39 @@ struct middle_point {
     index_t left = node.first_tri_idx;
     index_t right = left + node.tri_count - 1;
     while (left < right) {
-      if (triangles[indices[left]].centroid[split_axis] < split_pos) {
+      if (input.centroids[indices[left]][split_axis] < split_pos) {
         ++left;
       } else {
         std::swap(indices[left], indices[right--]);
       }
     }
+    if (left == right &&
+        input.centroids[indices[left]][split_axis] < split_pos) {
+      ++left;
+    }
 
     // create child nodes for each half
     index_t left_count = left - node.first_tri_idx;
     if (left_count == 0 || left_count == node.tri_count) return;
 
-    index_t left_node_idx = not_used++;
-    index_t right_node_idx = not_used++;
-    node.left_node = left_node_idx;
+    index_t tri_count = node.tri_count;
+    index_t left_node_idx = not_used.fetch_add(2);
+    index_t right_node_idx = left_node_idx + 1;
     nodes[left_node_idx].first_tri_idx = node.first_tri_idx;
     nodes[left_node_idx].tri_count = left_count;
     nodes[right_node_idx].first_tri_idx = left;
-    nodes[right_node_idx].tri_count = node.tri_count - left_count;
+    nodes[right_node_idx].tri_count = tri_count - left_count;
+
+    node.left_node = left_node_idx;
+    node.tri_count = 0;
 
-    split(left_node_idx);
-    split(right_node_idx);
+    if (options.parallel && tri_count >= parallel_grain) {
+      parallel_invoke([=, this] { split(left_node_idx); },
+                      [=, this] { split(right_node_idx); });
+    } else {
+      split(left_node_idx);
+      split(right_node_idx);
+    }
   }
 
  private:
@@ -54,15 +73,13 @@ struct middle_point {
     bvh_node& node = nodes[node_idx];
     index_t end = node.first_tri_idx + node.tri_count;
     for (index_t i = node.first_tri_idx; i < end; ++i) {
-      auto& tri = triangles[indices[i]];
-      node.bounds.grow(tri.vertex0);
-      node.bounds.grow(tri.vertex1);
-      node.bounds.grow(tri.vertex2);
+      node.bounds.grow(input.bounds[indices[i]]);
     }
   }
-  triangle_list& triangles;
+  const build_input& input;
 
-  std::vector<bvh_node> nodes;
-  std::vector<index_t> indices;
-  index_t not_used = 0;
+  std::vector<bvh_node>& nodes;
+  std::vector<index_t>& indices;
+  build_options options;
+  std::atomic<index_t> not_used = 2;
 };
\ No newline at end of file
@@ -0,0 +1,337 @@
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <filesystem>
+#include <format>
+#include <memory>
+#include <print>
+#include <string>
+#include <vector>
+
+#include "basic.hpp"
+#include "bvh.hpp"
+#include "lbvh.hpp"
+#include "model.hpp"
+#include "ploc.hpp"
+#include "quality.hpp"
+#include "sah.hpp"
+#include "sbvh.hpp"
+#include "wide.hpp"
+
+// headless benchmarks of every strategy: the build and single threaded
+// closest hit and occlusion traversal of fixed camera rays, and the closest
+// hit traversal with precomputed triangles and of the tree collapsed into a
+// bvh4 and a bvh8. Run it from the directory holding unity.tri and pass
+// --benchmark_out=<file> --benchmark_out_format=json for machine readable
+// results. Configured with BVH_STATS the traversal benchmarks also report
+// the per ray traversal counters.
+
+namespace {
+
+constexpr int ray_grid = 512;
+
+struct scene {
+  std::string name;
+  triangle_list triangles;
+  std::vector<ray> rays;
+};
+
+// pinhole camera through the screen corners p0 (top left), p1 (top right)
+// and p2 (bottom left), the same setups bvh.cpp shows
+std::vector<ray> camera_rays(float3 cam_pos, float3 p0, float3 p1, float3 p2) {
+  std::vector<ray> rays;
+  rays.reserve(ray_grid * ray_grid);
+  for (int y = 0; y < ray_grid; ++y) {
+    for (int x = 0; x < ray_grid; ++x) {
+      float u = x / float(ray_grid);
+      float v = y / float(ray_grid);
+      float3 pixel_pos = p0 + (p1 - p0) * u + (p2 - p0) * v;
+      rays.push_back(ray{cam_pos, normalize(pixel_pos - cam_pos)});
+    }
+  }
+  return rays;
+}
+
+std::vector<scene> load_scenes() {
+  std::vector<scene> scenes;
+  if (std::filesystem::exists("unity.tri") ||
+      std::filesystem::exists("unity.trib")) {
+    scenes.push_back({"unity", unity_model(),
+                      camera_rays(float3(-1.5f, -0.2f, -2.5f),
+                                  float3(-2.5f, 0.8f, -0.5f),
+                                  float3(-0.5f, 0.8f, -0.5f),
+                                  float3(-2.5f, -1.2f, -0.5f))});
+  } else {
+    std::println("unity.tri not found, only synthetic scenes are run");
+  }
+  for (size_t size : {1u << 10, 1u << 14, 1u << 17}) {
+    scenes.push_back({std::format("random_{}", size), make_triangles(size),
+                      camera_rays(float3(0, 0, -18), float3(-1, 1, -15),
+                                  float3(1, 1, -15), float3(-1, -1, -15))});
+  }
+  return scenes;
+}
+
+// per ray averages of the traversal counters, see BVH_STATS
+void set_counters([[maybe_unused]] benchmark::State& state,
+                  [[maybe_unused]] const traversal_stats& stats) {
+  BVH_STAT({
+    double n = std::max<uint64_t>(stats.rays, 1);
+    state.counters["inner_nodes"] = stats.inner_nodes / n;
+    state.counters["leaves"] = stats.leaves / n;
+    state.counters["aabb_tests"] = stats.aabb_tests / n;
+    state.counters["triangle_tests"] = stats.triangle_tests / n;
+    state.counters["max_stack_depth"] = stats.max_stack_depth;
+  });
+}
+
+// the camera rays as packets of 4x4 tiles. One lane of every packet is left
+// out of the active mask, so traversal also sees partial packets.
+std::vector<ray_packet<16>> camera_packets(const std::vector<ray>& rays) {
+  constexpr int tile = 4;
+  std::vector<ray_packet<16>> packets;
+  for (int y = 0; y < ray_grid; y += tile) {
+    for (int x = 0; x < ray_grid; x += tile) {
+      auto& p = packets.emplace_back();
+      for (int j = 0; j < tile * tile; ++j) {
+        p.set(j, rays[(y + j / tile) * ray_grid + x + j % tile]);
+      }
+      p.active &= ~(1u << (packets.size() % (tile * tile)));
+    }
+  }
+  return packets;
+}
+
+// active rays of the packets whose hit differs from a single ray traversal
+// by more than float noise, must be 0
+template <typename Tree>
+size_t packet_mismatches(const Tree& tree,
+                         const std::vector<ray_packet<16>>& packets,
+                         const std::vector<ray>& rays) {
+  size_t mismatches = 0;
+  for (size_t i = 0; i < packets.size(); ++i) {
+    ray_packet<16> p = packets[i];
+    tree.intersect(p);
+    for (int j = 0; j < 16; ++j) {
+      if ((p.active & (1u << j)) == 0) {
+        mismatches += p.t[j] != packets[i].t[j];
+        continue;
+      }
+      int x = i % (ray_grid / 4) * 4 + j % 4;
+      int y = i / (ray_grid / 4) * 4 + j / 4;
+      ray r = rays[y * ray_grid + x];
+      tree.intersect(r);
+      mismatches += std::abs(r.t - p.t[j]) > 1e-4f * std::min(r.t, 1.0f);
+    }
+  }
+  return mismatches;
+}
+
+// rays whose closest hit in tree is at another distance than in reference,
+// must be 0. Triangles hit at the same distance can both be right, and the
+// closer hit may be missed by the other kernel within float noise of its
+// edges.
+template <typename Tree>
+size_t hit_mismatches(const Tree& tree, const Tree& reference,
+                      const std::vector<ray>& rays) {
+  size_t mismatches = 0;
+  for (ray r : rays) {
+    ray expected = r;
+    tree.intersect(r);
+    reference.intersect(expected);
+    if (std::abs(r.t - expected.t) <= 1e-4f * expected.t) continue;
+    const ray& closer = r.t < expected.t ? r : expected;
+    float edge = std::min({closer.u, closer.v, 1 - closer.u - closer.v});
+    mismatches += edge > 1e-4f;
+  }
+  return mismatches;
+}
+
+// closest hit traversal of the binary tree built() returns, collapsed on
+// first use
+template <typename Wide, typename Built>
+void register_wide(const std::string& name, const scene& s, Built built) {
+  auto tree = std::make_shared<std::unique_ptr<Wide>>();
+  benchmark::RegisterBenchmark(
+      name.c_str(),
+      [&s, built, tree](benchmark::State& state) {
+        if (!*tree) *tree = std::make_unique<Wide>(built());
+        const Wide& wide = **tree;
+        size_t hits = 0;
+        traversal_stats stats;
+        for (auto _ : state) {
+          hits = 0;
+          stats = {};
+          for (ray r : s.rays) {
+            wide.intersect(r);
+            hits += r.t < 1e30f;
+            BVH_STAT(stats.add(r.stats));
+          }
+          benchmark::DoNotOptimize(hits);
+        }
+        state.SetItemsProcessed(state.iterations() * s.rays.size());
+        state.counters["hits"] = hits;
+        set_counters(state, stats);
+      })
+      ->Unit(benchmark::kMillisecond);
+}
+
+template <bvh_strategy Strategy>
+void register_strategy(const scene& s) {
+  const build_options options{.parallel = true};
+  std::string suffix = std::format("/{}/{}", Strategy::name, s.name);
+
+  benchmark::RegisterBenchmark(
+      ("build" + suffix).c_str(),
+      [&s, options](benchmark::State& state) {
+        bvh_quality quality;
+        for (auto _ : state) {
+          bvh<Strategy> tree(mesh_view(s.triangles), options);
+          state.PauseTiming();
+          quality = analyze(tree.get_nodes());
+          state.ResumeTiming();
+        }
+        state.SetItemsProcessed(state.iterations() * s.triangles.size());
+        state.counters["nodes"] = quality.inner_nodes + quality.leaves;
+        state.counters["sah_cost"] = quality.sah_cost;
+        state.counters["sibling_overlap"] = quality.sibling_overlap;
+      })
+      ->Unit(benchmark::kMillisecond)
+      ->UseRealTime();
+
+  // built on first use and shared by all traversal benchmarks
+  auto tree = std::make_shared<std::unique_ptr<bvh<Strategy>>>();
+  auto built = [&s, options, tree]() -> const bvh<Strategy>& {
+    if (!*tree) {
+      *tree = std::make_unique<bvh<Strategy>>(mesh_view(s.triangles),
+                                              options);
+    }
+    return **tree;
+  };
+
+  benchmark::RegisterBenchmark(
+      ("intersect" + suffix).c_str(),
+      [&s, built](benchmark::State& state) {
+        const auto& tree = built();
+        size_t hits = 0;
+        traversal_stats stats;
+        for (auto _ : state) {
+          hits = 0;
+          stats = {};
+          for (ray r : s.rays) {
+            tree.intersect(r);
+            hits += r.t < 1e30f;
+            BVH_STAT(stats.add(r.stats));
+          }
+          benchmark::DoNotOptimize(hits);
+        }
+        state.SetItemsProcessed(state.iterations() * s.rays.size());
+        state.counters["hits"] = hits;
+        set_counters(state, stats);
+      })
+      ->Unit(benchmark::kMillisecond);
+
+  benchmark::RegisterBenchmark(
+      ("occluded" + suffix).c_str(),
+      [&s, built](benchmark::State& state) {
+        const auto& tree = built();
+        size_t hits = 0;
+        traversal_stats stats;
+        for (auto _ : state) {
+          hits = 0;
+          stats = {};
+          for (ray r : s.rays) {
+            hits += tree.occluded(r);
+            BVH_STAT(stats.add(r.stats));
+          }
+          benchmark::DoNotOptimize(hits);
+        }
+        state.SetItemsProcessed(state.iterations() * s.rays.size());
+        state.counters["hits"] = hits;
+        set_counters(state, stats);
+      })
+      ->Unit(benchmark::kMillisecond);
+
+  benchmark::RegisterBenchmark(
+      ("intersect_packet" + suffix).c_str(),
+      [&s, built](benchmark::State& state) {
+        const auto& tree = built();
+        auto packets = camera_packets(s.rays);
+        size_t hits = 0;
+        traversal_stats stats;
+        for (auto _ : state) {
+          hits = 0;
+          stats = {};
+          for (ray_packet<16> p : packets) {
+            tree.intersect(p);
+            for (float t : p.t) hits += t < 1e30f;
+            BVH_STAT(stats.add(p.stats, std::popcount(p.active)));
+          }
+          benchmark::DoNotOptimize(hits);
+        }
+        state.SetItemsProcessed(state.iterations() * s.rays.size());
+        state.counters["hits"] = hits;
+        state.counters["mismatches"] =
+            packet_mismatches(tree, packets, s.rays);
+        set_counters(state, stats);
+      })
+      ->Unit(benchmark::kMillisecond);
+
+  // the same tree with precompute_triangles, built on first use
+  auto accel = std::make_shared<std::unique_ptr<bvh<Strategy>>>();
+  benchmark::RegisterBenchmark(
+      ("intersect_accel" + suffix).c_str(),
+      [&s, options, built, accel](benchmark::State& state) {
+        if (!*accel) {
+          build_options accel_options = options;
+          accel_options.precompute_triangles = true;
+          *accel = std::make_unique<bvh<Strategy>>(mesh_view(s.triangles),
+                                                   accel_options);
+        }
+        const auto& tree = **accel;
+        size_t hits = 0;
+        traversal_stats stats;
+        for (auto _ : state) {
+          hits = 0;
+          stats = {};
+          for (ray r : s.rays) {
+            tree.intersect(r);
+            hits += r.t < 1e30f;
+            BVH_STAT(stats.add(r.stats));
+          }
+          benchmark::DoNotOptimize(hits);
+        }
+        state.SetItemsProcessed(state.iterations() * s.rays.size());
+        state.counters["hits"] = hits;
+        state.counters["mismatches"] = hit_mismatches(tree, built(), s.rays);
+        set_counters(state, stats);
+      })
+      ->Unit(benchmark::kMillisecond);
+
+  register_wide<bvh4>("intersect_bvh4" + suffix, s, built);
+  register_wide<bvh8>("intersect_bvh8" + suffix, s, built);
+}
+
+template <bvh_strategy... Strategies>
+void register_strategies(const std::vector<scene>& scenes) {
+  for (const auto& s : scenes) (register_strategy<Strategies>(s), ...);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+
+  // registered benchmarks keep references to the scenes
+  static const auto scenes = load_scenes();
+  register_strategies<middle_point, sah, binned_sah, lbvh, lbvh64, ploc, sbvh>(
+      scenes);
+
+  benchmark::AddCustomContext("simd_width", std::to_string(simd_width));
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
\ No newline at end of file
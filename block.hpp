@@ -0,0 +1,103 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cstdint>
+
+#include "base.hpp"
+#include "simd.hpp"
+
+// N triangles of one leaf in structure of arrays form. Leaves are padded to
+// whole blocks, unused lanes have zero edges and are never hit.
+template <int N>
+struct alignas(32) tri_block {
+  tri_block() { prim.fill(invalid_index); }
+
+  void set(int i, const triangle& tri, index_t tri_prim) {
+    float3 e1 = tri.vertex1 - tri.vertex0;
+    float3 e2 = tri.vertex2 - tri.vertex0;
+    v0_x[i] = tri.vertex0.x;
+    v0_y[i] = tri.vertex0.y;
+    v0_z[i] = tri.vertex0.z;
+    e1_x[i] = e1.x;
+    e1_y[i] = e1.y;
+    e1_z[i] = e1.z;
+    e2_x[i] = e2.x;
+    e2_y[i] = e2.y;
+    e2_z[i] = e2.z;
+    prim[i] = tri_prim;
+  }
+
+  std::array<float, N> v0_x{}, v0_y{}, v0_z{};
+  std::array<float, N> e1_x{}, e1_y{}, e1_z{};
+  std::array<float, N> e2_x{}, e2_y{}, e2_z{};
+  std::array<index_t, N> prim;
+};
+
+template <int N>
+struct block_hits {
+  vbool<N> hit;
+  vfloat<N> t, u, v;
+};
+
+// moller-trumbore for one ray against all triangles of a block
+template <int N>
+block_hits<N> intersect_lanes(const tri_block<N>& b, const ray& r) {
+  using vf = vfloat<N>;
+  using vf3 = vfloat3<N>;
+
+  const vf3 e1(vf::load(b.e1_x.data()), vf::load(b.e1_y.data()),
+               vf::load(b.e1_z.data()));
+  const vf3 e2(vf::load(b.e2_x.data()), vf::load(b.e2_y.data()),
+               vf::load(b.e2_z.data()));
+  const vf3 v0(vf::load(b.v0_x.data()), vf::load(b.v0_y.data()),
+               vf::load(b.v0_z.data()));
+  const vf3 d(r.direction.x, r.direction.y, r.direction.z);
+  const vf3 o(r.origin.x, r.origin.y, r.origin.z);
+  const vf zero(0.0f), one(1.0f), eps(1e-4f);
+
+  vf3 pv = cross(d, e2);
+  vf det = dot(e1, pv);
+  // is_parallel per lane, padding lanes have n = 0 and are culled
+  vf3 n = cross(e1, e2);
+  vf min_det2 = vf(parallel_cos * parallel_cos) * dot(n, n);
+  vf inv_det = one / det;
+  vf3 tvec = o - v0;
+  vf u = dot(tvec, pv) * inv_det;
+  vf3 q = cross(tvec, e1);
+  vf v = dot(d, q) * inv_det;
+  vf tt = dot(e2, q) * inv_det;
+
+  auto hit = (det * det > min_det2) & (u >= zero) & (u <= one) & (v >= zero) &
+             (u + v <= one) & (tt > eps) & (tt < vf(r.t));
+  return {hit, tt, u, v};
+}
+
+// closest hit among the lanes of a block
+template <int N>
+void intersect_tri(const tri_block<N>& b, ray& r) {
+  auto h = intersect_lanes(b, r);
+  int mask = h.hit.mask();
+  if (mask == 0) return;
+
+  alignas(32) std::array<float, N> hit_t, hit_u, hit_v;
+  select(h.hit, h.t, vfloat<N>(max_v<float>)).store(hit_t.data());
+  int best = std::countr_zero(static_cast<unsigned>(mask));
+  for (mask &= mask - 1; mask != 0; mask &= mask - 1) {
+    int i = std::countr_zero(static_cast<unsigned>(mask));
+    if (hit_t[i] < hit_t[best]) best = i;
+  }
+  h.u.store(hit_u.data());
+  h.v.store(hit_v.data());
+  r.t = hit_t[best];
+  r.u = hit_u[best];
+  r.v = hit_v[best];
+  r.prim = b.prim[best];
+}
+
+template <int N>
+bool occluded_tri(const tri_block<N>& b, const ray& r) {
+  return intersect_lanes(b, r).hit.mask() != 0;
+}
+
+using leaf_block = tri_block<simd_width>;
\ No newline at end of file
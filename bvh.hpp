@@ -1,30 +1,170 @@
 #pragma once
 
+#include <array>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <memory_resource>
 #include <numeric>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
 #include <vector>
 
 #include "base.hpp"
+#include "block.hpp"
+#include "mapped_file.hpp"
+#include "packet.hpp"
+#include "parallel.hpp"
 
 template <typename T>
 concept bvh_strategy =
-    requires(T t, index_t i, triangle_list& tris, std::vector<bvh_node>& nodes,
-             std::vector<index_t>& indices) {
+    requires(T t, index_t i, const build_input& input,
+             std::vector<bvh_node>& nodes, std::vector<index_t>& indices,
+             const build_options& options) {
       { t.split(i) } -> std::same_as<void>;
-      T{tris, nodes, indices};
+      T{input, nodes, indices, options};
+      // identifies the builder in saved trees
+      { T::name } -> std::convertible_to<std::string_view>;
     };
 
+// file layout of a saved bvh: this header, the used nodes and the indices.
+// The nodes start 32 byte aligned so the file is used in place when mapped.
+struct bvh_file_header {
+  static constexpr std::array<char, 4> bvh_magic{'B', 'V', 'H', 'C'};
+  static constexpr uint32_t current_version = 2;
+
+  std::array<char, 4> magic = bvh_magic;
+  uint32_t version = current_version;
+  std::array<char, 16> strategy{};
+  uint64_t hash = 0;  // of the vertices the tree was built for
+  uint32_t triangle_count = 0;
+  uint32_t node_count = 0;
+  uint32_t index_count = 0;
+  uint32_t leaf_granularity = 0;
+  std::array<char, 16> padding{};
+};
+static_assert(sizeof(bvh_file_header) == 64);
+
+// fills in the options whose defaults depend on other options
+build_options inline with_defaults(build_options options) {
+  if (options.leaf_granularity == 0) {
+    options.leaf_granularity = options.simd_leaves ? simd_width : 1;
+  }
+  return options;
+}
+
 template <bvh_strategy Strategy>
 struct bvh {
-  bvh(triangle_list& tris) : triangles(tris) { build(); }
+  // the mesh buffers must outlive the bvh, traversal reads them
+  bvh(const mesh_view& mesh, build_options options = {})
+      : triangles(mesh), options(with_defaults(options)) {
+    build();
+  }
+  // loads the tree saved at path when it was built by the same strategy for
+  // the same triangles, otherwise builds it and saves it there. A file that
+  // cannot be read or written is reported and the tree built all the same.
+  bvh(const mesh_view& mesh, build_options options, const std::string& path)
+      : triangles(mesh), options(with_defaults(options)) {
+    load_or_build(path);
+  }
+
+  // a triangle list is viewed as a mesh that does not share vertices
+  bvh(triangle_list& tris, build_options options = {})
+      : bvh(mesh_view(tris), options) {}
+  bvh(triangle_list& tris, build_options options, const std::string& path)
+      : bvh(mesh_view(tris), options, path) {}
 
   void intersect(ray& r) const;
+  // true if anything is hit before r.t, stops at the first hit found
+  bool occluded(const ray& r) const;
+  // traverses the tree once for all rays of the packet
+  template <int N>
+  void intersect(ray_packet<N>& p) const;
+
+  // recomputes the bounds of all nodes from the current vertices while
+  // keeping the topology, for meshes that deform without changing it
+  void refit();
+  // only refits the leaves holding the changed triangles and their
+  // ancestors. Falls back to refit() if a triangle is in several leaves.
+  void refit(std::span<const index_t> changed);
+
+  // lowers the sah cost with node rotations (Kensler 2008), for example to
+  // repair a tree after many refits. Stops after budget_ms, the next call
+  // continues where this one stopped. Returns the number of rotations done.
+  index_t optimize(float budget_ms);
+
+  const mesh_view& get_mesh() const { return triangles; }
+  // writes the tree in the bvh_file_header layout
+  void save(const std::string& path) const;
+  // maps a tree written by save. Returns false and keeps the current tree
+  // if the file is missing, was written by another strategy or version, the
+  // triangles changed since, or the tree in it is damaged.
+  bool load(const std::string& path);
+
+  std::span<const bvh_node> get_nodes() const { return nodes; }
+  std::span<const index_t> get_indices() const { return indices; }
+  const std::vector<tri_accel>& get_accel() const { return accel; }
+  const std::vector<leaf_block>& get_blocks() const { return blocks; }
 
  private:
+  // bytes per triangle the build arena holds for the strategy on top of the
+  // input, enough for the morton codes, their sort buffers and the clusters
+  // of ploc
+  static constexpr size_t arena_slack = 64;
+
   void build();
+  void load_or_build(const std::string& path);
+  void prepare_leaves();
+  uint64_t triangle_hash() const;
+  bool valid_tree(std::span<const bvh_node> tree_nodes,
+                  std::span<const index_t> tree_indices) const;
+  index_t used_nodes() const;
+  void precompute_triangles();
+  void build_blocks();
+  void build_topology();
+  void refit_nodes(const std::vector<index_t>& level);
+  void start_rotation_pass();
+  bool rotate(index_t node_idx);
+  void swap_nodes(index_t a, index_t b);
+
+  mesh_view triangles;
+  build_options options;
+  // the tree lives in the vectors after a build and in the mapping after a
+  // load, traversal only uses the spans
+  std::vector<bvh_node> node_storage;
+  std::vector<index_t> index_storage;
+  std::optional<mapped_file> mapping;
+  std::span<bvh_node> nodes;
+  std::span<index_t> indices;
+  // leaf ordered copy of the triangles, accel[i] belongs to indices[i]
+  std::vector<tri_accel> accel;
+  // leaves padded to whole simd blocks, the blocks of a leaf node start at
+  // block_offset[node index]
+  std::vector<leaf_block> blocks;
+  std::vector<index_t> block_offset;
 
-  triangle_list& triangles;
-  std::vector<bvh_node> nodes;
-  std::vector<index_t> indices;
+  // tree structure used by refit, filled on the first call
+  struct refit_topology {
+    std::vector<std::vector<index_t>> levels;  // node indices by depth
+    std::vector<index_t> parent, depth;        // per node
+    std::vector<index_t> leaf;                 // leaf node of an index slot
+    std::vector<index_t> slot;  // index slot of a triangle, if it is unique
+    std::vector<uint8_t> marked;
+  } topology;
+
+  // progress of optimize between calls
+  struct rotation_state {
+    std::vector<index_t> order;           // inner nodes, deepest first
+    std::vector<index_t> parent, height;  // per node slot
+    index_t cursor = 0;
+    bool rotated = false;  // in the current pass
+  } rotation;
 };
 
 template <bvh_strategy Strategy>
@@ -35,15 +175,34 @@ void bvh<Strategy>::intersect(ray& r) const {
 
   while (true) {
     if (node->is_leaf()) {
-      for (int i = node->first_tri_idx;
-           i < (node->first_tri_idx + node->tri_count); ++i) {
-        intersect_tri(triangles[indices[i]], r);
+      BVH_STAT(++r.stats.leaves);
+      if (!blocks.empty()) {
+        index_t first = block_offset[node - nodes.data()];
+        index_t count = padded_count(node->tri_count, simd_width) / simd_width;
+        BVH_STAT(r.stats.triangle_tests += count * simd_width);
+        for (index_t i = first; i < first + count; ++i) {
+          intersect_tri(blocks[i], r);
+        }
+      } else if (!accel.empty()) {
+        BVH_STAT(r.stats.triangle_tests += node->tri_count);
+        for (index_t i = node->first_tri_idx;
+             i < (node->first_tri_idx + node->tri_count); ++i) {
+          intersect_tri(accel[i], r);
+        }
+      } else {
+        BVH_STAT(r.stats.triangle_tests += node->tri_count);
+        for (index_t i = node->first_tri_idx;
+             i < (node->first_tri_idx + node->tri_count); ++i) {
+          intersect_tri(triangles[indices[i]], r, indices[i]);
+        }
       }
       if (stack_idx == 0) break;
       node = stack[--stack_idx];
       continue;
     }
 
+    BVH_STAT(++r.stats.inner_nodes);
+    BVH_STAT(r.stats.aabb_tests += 2);
     const bvh_node* child1 = &nodes[node->left_node];
     const bvh_node* child2 = &nodes[node->left_node + 1];
     float dist1 = child1->bounds.intersect2(r);
@@ -61,26 +220,653 @@ void bvh<Strategy>::intersect(ray& r) const {
 
     node = child1;
     if (dist2 < 1e30f) stack[stack_idx++] = child2;
+    BVH_STAT(r.stats.max_stack_depth =
+                 std::max(r.stats.max_stack_depth, stack_idx));
   }
 }
 
 template <bvh_strategy Strategy>
-void bvh<Strategy>::build() {
-  TRACE;
+bool bvh<Strategy>::occluded(const ray& r) const {
+  const bvh_node* node = &nodes[0];
+  std::array<const bvh_node*, 64> stack{};
+  index_t stack_idx = 0;
 
-  indices.resize(triangles.size());
-  std::iota(indices.begin(), indices.end(), 0);
+  while (true) {
+    if (node->is_leaf()) {
+      BVH_STAT(++r.stats.leaves);
+      if (!blocks.empty()) {
+        index_t first = block_offset[node - nodes.data()];
+        index_t count = padded_count(node->tri_count, simd_width) / simd_width;
+        for (index_t i = first; i < first + count; ++i) {
+          BVH_STAT(r.stats.triangle_tests += simd_width);
+          if (occluded_tri(blocks[i], r)) return true;
+        }
+      } else {
+        for (index_t i = node->first_tri_idx;
+             i < (node->first_tri_idx + node->tri_count); ++i) {
+          BVH_STAT(++r.stats.triangle_tests);
+          if (accel.empty() ? occluded_tri(triangles[indices[i]], r)
+                            : occluded_tri(accel[i], r)) {
+            return true;
+          }
+        }
+      }
+    } else {
+      // any hit will do, so children are not ordered by distance
+      BVH_STAT(++r.stats.inner_nodes);
+      BVH_STAT(r.stats.aabb_tests += 2);
+      const bvh_node* child1 = &nodes[node->left_node];
+      const bvh_node* child2 = &nodes[node->left_node + 1];
+      bool hit1 = child1->bounds.intersect(r);
+      bool hit2 = child2->bounds.intersect(r);
+      if (hit1 && hit2) stack[stack_idx++] = child2;
+      BVH_STAT(r.stats.max_stack_depth =
+                   std::max(r.stats.max_stack_depth, stack_idx));
+      if (hit1 || hit2) {
+        node = hit1 ? child1 : child2;
+        continue;
+      }
+    }
 
-  // compute centroids
-  for (auto& tri : triangles) {
-    tri.centroid = (tri.vertex0 + tri.vertex1 + tri.vertex2) * 0.3333f;
+    if (stack_idx == 0) return false;
+    node = stack[--stack_idx];
   }
+}
+
+template <bvh_strategy Strategy>
+template <int N>
+void bvh<Strategy>::intersect(ray_packet<N>& p) const {
+  // a node together with the rays that hit its box
+  struct entry {
+    const bvh_node* node;
+    uint32_t mask;
+  };
+  std::array<entry, 64> stack{};
+  index_t stack_idx = 0;
+
+  float dist{};
+  entry current{&nodes[0], intersect_box(nodes[0].bounds, p, dist, p.active)};
+  BVH_STAT(++p.stats.aabb_tests);
+  if (current.mask == 0) return;
+
+  while (true) {
+    const bvh_node* node = current.node;
+    if (node->is_leaf()) {
+      BVH_STAT(++p.stats.leaves);
+      BVH_STAT(p.stats.triangle_tests += node->tri_count);
+      for (index_t i = node->first_tri_idx;
+           i < (node->first_tri_idx + node->tri_count); ++i) {
+        intersect_tri(triangles[indices[i]], p, current.mask, indices[i]);
+      }
+      if (stack_idx == 0) break;
+      current = stack[--stack_idx];
+      continue;
+    }
+
+    BVH_STAT(++p.stats.inner_nodes);
+    BVH_STAT(p.stats.aabb_tests += 2);
+    entry child1{&nodes[node->left_node], 0};
+    entry child2{&nodes[node->left_node + 1], 0};
+    float dist1{}, dist2{};
+    // only the rays that hit the parent are tested, and only they decide
+    // the order. A child no ray hits is 1e30f away and sorted last.
+    child1.mask = intersect_box(child1.node->bounds, p, dist1, current.mask);
+    child2.mask = intersect_box(child2.node->bounds, p, dist2, current.mask);
+    if (dist1 > dist2 || child1.mask == 0) {
+      std::swap(dist1, dist2);
+      std::swap(child1, child2);
+    }
+
+    if (child1.mask == 0) {
+      if (stack_idx == 0) break;
+      current = stack[--stack_idx];
+      continue;
+    }
 
-  nodes.resize(triangles.size() * 2);
-  bvh_node& root = nodes[0];
+    current = child1;
+    if (child2.mask != 0) stack[stack_idx++] = child2;
+    BVH_STAT(p.stats.max_stack_depth =
+                 std::max(p.stats.max_stack_depth, stack_idx));
+  }
+}
+
+template <bvh_strategy Strategy>
+void bvh<Strategy>::build() {
+  TRACE;
+
+  mapping.reset();
+  index_storage.resize(triangles.size());
+  std::iota(index_storage.begin(), index_storage.end(), 0);
+
+  // a binary tree over n triangles has at most 2n - 1 nodes, plus the
+  // unused slot 1
+  node_storage.assign(triangles.size() * 2, bvh_node{});
+  bvh_node& root = node_storage[0];
   root.first_tri_idx = 0;
   root.tri_count = triangles.size();
 
-  Strategy strategy(triangles, nodes, indices);
-  strategy.split(0);
+  // bounds, centroids and the serial scratch of the strategy share one arena
+  // that is dropped as a whole once the strategy is done
+  {
+    std::pmr::monotonic_buffer_resource arena(
+        std::max<size_t>(triangles.size(), 1) *
+        (sizeof(aabb) + sizeof(float3) + arena_slack));
+    build_input input{triangles, &arena,
+                      std::pmr::vector<aabb>(triangles.size(), &arena),
+                      std::pmr::vector<float3>(triangles.size(), &arena)};
+    auto prepare_input = [&](index_t first, index_t last) {
+      for (index_t i = first; i < last; ++i) {
+        triangle tri = triangles[i];
+        input.bounds[i] = aabb{};
+        input.bounds[i].grow(tri.vertex0);
+        input.bounds[i].grow(tri.vertex1);
+        input.bounds[i].grow(tri.vertex2);
+        input.centroids[i] = (tri.vertex0 + tri.vertex1 + tri.vertex2) / 3;
+      }
+    };
+    if (options.parallel) {
+      parallel_for(0, triangles.size(), prepare_input);
+    } else {
+      prepare_input(0, triangles.size());
+    }
+
+    Strategy strategy(input, node_storage, index_storage, options);
+    strategy.split(0);
+  }
+
+  // drop the slots the strategy did not use
+  nodes = node_storage;
+  node_storage.resize(used_nodes());
+  node_storage.shrink_to_fit();
+  index_storage.shrink_to_fit();
+
+  nodes = node_storage;
+  indices = index_storage;
+  prepare_leaves();
+}
+
+template <bvh_strategy Strategy>
+void bvh<Strategy>::load_or_build(const std::string& path) {
+  // the file is only a cache, the tree is built whenever it cannot be read
+  // and kept when it cannot be written
+  try {
+    if (load(path)) return;
+  } catch (const std::exception& e) {
+    std::println("{}, building the tree", e.what());
+  }
+  build();
+  try {
+    save(path);
+  } catch (const std::exception& e) {
+    std::error_code ec;
+    std::filesystem::remove(path + ".tmp", ec);
+    std::println("{}, the tree is not cached", e.what());
+  }
+}
+
+template <bvh_strategy Strategy>
+void bvh<Strategy>::prepare_leaves() {
+  topology = {};
+  rotation = {};
+  accel.clear();
+  blocks.clear();
+  block_offset.clear();
+  if (options.precompute_triangles) precompute_triangles();
+  if (options.simd_leaves) build_blocks();
+}
+
+template <bvh_strategy Strategy>
+uint64_t bvh<Strategy>::triangle_hash() const {
+  // a packed triangle list is hashed as one buffer, costs about as much as
+  // reading the vertices once
+  if (triangles.indices.empty() && triangles.stride == sizeof(float3)) {
+    return fnv1a(triangles.vertices, triangles.size() * sizeof(triangle));
+  }
+  uint64_t hash = fnv1a(nullptr, 0);
+  for (index_t i = 0; i < triangles.size(); ++i) {
+    triangle tri = triangles[i];
+    hash = fnv1a(&tri, sizeof(tri), hash);
+  }
+  return hash;
+}
+
+// strategies leave unused slots behind, only save up to the last used one
+template <bvh_strategy Strategy>
+index_t bvh<Strategy>::used_nodes() const {
+  index_t last = 0;
+  std::vector<index_t> stack{0};
+  while (!stack.empty()) {
+    const bvh_node& node = nodes[stack.back()];
+    stack.pop_back();
+    if (node.is_leaf()) continue;
+    last = std::max(last, node.left_node + 1);
+    stack.push_back(node.left_node);
+    stack.push_back(node.left_node + 1);
+  }
+  return last + 1;
+}
+
+template <bvh_strategy Strategy>
+void bvh<Strategy>::save(const std::string& path) const {
+  TRACE;
+
+  bvh_file_header header;
+  std::string_view name = Strategy::name;
+  std::copy_n(name.begin(), std::min(name.size(), header.strategy.size()),
+              header.strategy.begin());
+  header.hash = triangle_hash();
+  header.triangle_count = triangles.size();
+  header.node_count = used_nodes();
+  header.index_count = indices.size();
+  header.leaf_granularity = options.leaf_granularity;
+
+  // other processes may have the old file mapped, it is replaced as a whole
+  // instead of being rewritten under them. A crash leaves only the tmp file.
+  std::string tmp_path = path + ".tmp";
+  {
+    std::ofstream ofs(tmp_path, std::ios::binary);
+    if (!ofs.is_open()) throw std::runtime_error("failed to create " + path);
+    ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    ofs.write(reinterpret_cast<const char*>(nodes.data()),
+              header.node_count * sizeof(bvh_node));
+    ofs.write(reinterpret_cast<const char*>(indices.data()),
+              header.index_count * sizeof(index_t));
+    ofs.close();
+    if (!ofs) throw std::runtime_error("failed to write " + path);
+  }
+  std::error_code ec;
+  std::filesystem::rename(tmp_path, path, ec);
+  if (ec) {
+    throw std::runtime_error("failed to replace " + path + ": " +
+                             ec.message());
+  }
+}
+
+template <bvh_strategy Strategy>
+bool bvh<Strategy>::load(const std::string& path) {
+  TRACE;
+
+  if (!std::filesystem::exists(path)) return false;
+  // copy on write, so refit and optimize still work on a loaded tree
+  mapped_file file(path, true);
+  auto bytes = file.writable_bytes();
+  bvh_file_header header;
+  if (bytes.size() < sizeof(header)) return false;
+  std::memcpy(&header, bytes.data(), sizeof(header));
+
+  bvh_file_header expected;
+  std::string_view name = Strategy::name;
+  std::copy_n(name.begin(), std::min(name.size(), expected.strategy.size()),
+              expected.strategy.begin());
+  size_t size = sizeof(header) + header.node_count * sizeof(bvh_node) +
+                header.index_count * sizeof(index_t);
+  if (header.magic != expected.magic || header.version != expected.version ||
+      header.strategy != expected.strategy ||
+      header.leaf_granularity != options.leaf_granularity ||
+      header.triangle_count != triangles.size() || bytes.size() != size ||
+      header.node_count == 0 || header.hash != triangle_hash()) {
+    return false;
+  }
+
+  std::byte* data = bytes.data() + sizeof(header);
+  std::span<bvh_node> file_nodes{reinterpret_cast<bvh_node*>(data),
+                                 header.node_count};
+  data += header.node_count * sizeof(bvh_node);
+  std::span<index_t> file_indices{reinterpret_cast<index_t*>(data),
+                                  header.index_count};
+  if (!valid_tree(file_nodes, file_indices)) return false;
+
+  nodes = file_nodes;
+  indices = file_indices;
+  mapping = std::move(file);
+  node_storage = {};
+  index_storage = {};
+  prepare_leaves();
+  return true;
+}
+
+// a damaged file can pass the header checks, traversal trusts every child
+// link, leaf range and index of the tree
+template <bvh_strategy Strategy>
+bool bvh<Strategy>::valid_tree(std::span<const bvh_node> tree_nodes,
+                               std::span<const index_t> tree_indices) const {
+  for (index_t prim : tree_indices) {
+    if (prim >= triangles.size()) return false;
+  }
+  // every node is reached once from the root, more visits mean a cycle. The
+  // traversal stacks hold 64 nodes, which limits the depth.
+  size_t visited = 0;
+  std::vector<std::pair<index_t, index_t>> stack{{0, 0}};  // node, depth
+  while (!stack.empty()) {
+    auto [node_idx, depth] = stack.back();
+    stack.pop_back();
+    if (++visited > tree_nodes.size() || depth > 64) return false;
+    const bvh_node& node = tree_nodes[node_idx];
+    if (node.is_leaf()) {
+      if (uint64_t(node.first_tri_idx) + node.tri_count > tree_indices.size()) {
+        return false;
+      }
+      continue;
+    }
+    if (uint64_t(node.left_node) + 1 >= tree_nodes.size()) return false;
+    stack.push_back({node.left_node, depth + 1});
+    stack.push_back({node.left_node + 1, depth + 1});
+  }
+  return true;
+}
+
+template <bvh_strategy Strategy>
+void bvh<Strategy>::precompute_triangles() {
+  accel.resize(indices.size());
+  auto compute = [this](index_t first, index_t last) {
+    for (index_t i = first; i < last; ++i) {
+      accel[i] = tri_accel(triangles[indices[i]], indices[i]);
+    }
+  };
+  if (options.parallel) {
+    parallel_for(0, indices.size(), compute);
+  } else {
+    compute(0, indices.size());
+  }
+}
+
+template <bvh_strategy Strategy>
+void bvh<Strategy>::build_blocks() {
+  TRACE;
+
+  // hand out block ranges to the leaves in depth first order
+  std::vector<index_t> leaves;
+  block_offset.assign(nodes.size(), 0);
+  index_t block_count = 0;
+  std::vector<index_t> stack{0};
+  while (!stack.empty()) {
+    index_t node_idx = stack.back();
+    stack.pop_back();
+    const bvh_node& node = nodes[node_idx];
+    if (node.is_leaf()) {
+      leaves.push_back(node_idx);
+      block_offset[node_idx] = block_count;
+      block_count += padded_count(node.tri_count, simd_width) / simd_width;
+      continue;
+    }
+    stack.push_back(node.left_node + 1);
+    stack.push_back(node.left_node);
+  }
+
+  blocks.assign(block_count, leaf_block{});
+  auto fill = [&](index_t first, index_t last) {
+    for (index_t l = first; l < last; ++l) {
+      const bvh_node& node = nodes[leaves[l]];
+      leaf_block* block = &blocks[block_offset[leaves[l]]];
+      for (index_t i = 0; i < node.tri_count; ++i) {
+        index_t prim = indices[node.first_tri_idx + i];
+        block[i / simd_width].set(i % simd_width, triangles[prim], prim);
+      }
+    }
+  };
+  if (options.parallel) {
+    parallel_for(0, leaves.size(), fill, 64);
+  } else {
+    fill(0, leaves.size());
+  }
+}
+
+template <bvh_strategy Strategy>
+void bvh<Strategy>::build_topology() {
+  auto& [levels, parent, depth, leaf, slot, marked] = topology;
+  parent.assign(nodes.size(), invalid_index);
+  depth.assign(nodes.size(), 0);
+  leaf.assign(indices.size(), invalid_index);
+  marked.assign(nodes.size(), 0);
+  levels = {{0}};
+  for (index_t d = 0; d < levels.size(); ++d) {
+    std::vector<index_t> next;
+    for (index_t node_idx : levels[d]) {
+      const bvh_node& node = nodes[node_idx];
+      depth[node_idx] = d;
+      if (node.is_leaf()) {
+        index_t end = node.first_tri_idx + node.tri_count;
+        for (index_t i = node.first_tri_idx; i < end; ++i) leaf[i] = node_idx;
+        continue;
+      }
+      for (index_t child : {node.left_node, node.left_node + 1}) {
+        parent[child] = node_idx;
+        next.push_back(child);
+      }
+    }
+    if (!next.empty()) levels.push_back(std::move(next));
+  }
+
+  slot.clear();
+  if (indices.size() == triangles.size()) {
+    slot.resize(triangles.size());
+    for (index_t i = 0; i < indices.size(); ++i) slot[indices[i]] = i;
+  }
+}
+
+// every node of a level only reads the level below, so a level is refit
+// in parallel
+template <bvh_strategy Strategy>
+void bvh<Strategy>::refit_nodes(const std::vector<index_t>& level) {
+  auto refit_range = [&](index_t first, index_t last) {
+    for (index_t i = first; i < last; ++i) {
+      bvh_node& node = nodes[level[i]];
+      aabb bounds;
+      if (node.is_leaf()) {
+        index_t end = node.first_tri_idx + node.tri_count;
+        for (index_t j = node.first_tri_idx; j < end; ++j) {
+          for (int k = 0; k < 3; ++k) {
+            bounds.grow(triangles.vertex(indices[j], k));
+          }
+        }
+      } else {
+        bounds.grow(nodes[node.left_node].bounds);
+        bounds.grow(nodes[node.left_node + 1].bounds);
+      }
+      node.bounds = bounds;
+    }
+  };
+  if (options.parallel) {
+    parallel_for(0, level.size(), refit_range, 256);
+  } else {
+    refit_range(0, level.size());
+  }
+}
+
+template <bvh_strategy Strategy>
+void bvh<Strategy>::refit() {
+  TRACE;
+
+  if (topology.levels.empty()) build_topology();
+  for (auto level = topology.levels.rbegin(); level != topology.levels.rend();
+       ++level) {
+    refit_nodes(*level);
+  }
+
+  if (!accel.empty()) precompute_triangles();
+  if (!blocks.empty()) build_blocks();
+}
+
+template <bvh_strategy Strategy>
+void bvh<Strategy>::refit(std::span<const index_t> changed) {
+  if (topology.levels.empty()) build_topology();
+  if (topology.slot.empty()) {
+    refit();
+    return;
+  }
+
+  // collect the leaves of the changed triangles and all their ancestors
+  auto& [levels, parent, depth, leaf, slot, marked] = topology;
+  std::vector<std::vector<index_t>> dirty(levels.size());
+  for (index_t prim : changed) {
+    index_t i = slot[prim];
+    index_t leaf_idx = leaf[i];
+    if (!accel.empty()) accel[i] = tri_accel(triangles[prim], prim);
+    if (!blocks.empty()) {
+      index_t lane = i - nodes[leaf_idx].first_tri_idx;
+      blocks[block_offset[leaf_idx] + lane / simd_width].set(
+          lane % simd_width, triangles[prim], prim);
+    }
+    for (index_t n = leaf_idx; n != invalid_index && !marked[n];
+         n = parent[n]) {
+      marked[n] = 1;
+      dirty[depth[n]].push_back(n);
+    }
+  }
+
+  for (auto level = dirty.rbegin(); level != dirty.rend(); ++level) {
+    refit_nodes(*level);
+    for (index_t n : *level) marked[n] = 0;
+  }
+}
+
+template <bvh_strategy Strategy>
+void bvh<Strategy>::start_rotation_pass() {
+  auto& [order, parent, height, cursor, rotated] = rotation;
+  order.clear();
+  parent.assign(nodes.size(), invalid_index);
+  height.assign(nodes.size(), 0);
+  cursor = 0;
+  rotated = false;
+  std::vector<index_t> queue{0};
+  for (index_t i = 0; i < queue.size(); ++i) {
+    const bvh_node& node = nodes[queue[i]];
+    if (node.is_leaf()) continue;
+    order.push_back(queue[i]);
+    for (index_t child : {node.left_node, node.left_node + 1}) {
+      parent[child] = queue[i];
+      queue.push_back(child);
+    }
+  }
+  std::reverse(order.begin(), order.end());
+  for (index_t node_idx : order) {
+    const bvh_node& node = nodes[node_idx];
+    height[node_idx] =
+        1 + std::max(height[node.left_node], height[node.left_node + 1]);
+  }
+}
+
+// moves the contents of two slots, their subtrees move along
+template <bvh_strategy Strategy>
+void bvh<Strategy>::swap_nodes(index_t a, index_t b) {
+  std::swap(nodes[a], nodes[b]);
+  std::swap(rotation.height[a], rotation.height[b]);
+  if (!block_offset.empty()) std::swap(block_offset[a], block_offset[b]);
+  for (index_t slot : {a, b}) {
+    if (nodes[slot].is_leaf()) continue;
+    rotation.parent[nodes[slot].left_node] = slot;
+    rotation.parent[nodes[slot].left_node + 1] = slot;
+  }
+}
+
+// tries to swap a child of the node with a grandchild, or two grandchildren.
+// Only the bounds of the children change, so the gain is the decrease of
+// their surface area.
+template <bvh_strategy Strategy>
+bool bvh<Strategy>::rotate(index_t node_idx) {
+  // keeps the deepest path within the traversal stack of bvh::intersect
+  constexpr index_t max_depth = 48;
+
+  const bvh_node& node = nodes[node_idx];
+  if (node.is_leaf()) return false;
+  auto& height = rotation.height;
+  auto merged_area = [this](index_t a, index_t b) {
+    aabb bounds = nodes[a].bounds;
+    bounds.grow(nodes[b].bounds);
+    return bounds.area();
+  };
+
+  index_t depth = 0;
+  for (index_t n = node_idx; rotation.parent[n] != invalid_index;
+       n = rotation.parent[n]) {
+    ++depth;
+  }
+
+  float best_gain = node.bounds.area() * 1e-5f;
+  index_t swap_a = invalid_index, swap_b = invalid_index;
+  std::array<index_t, 2> children{node.left_node, node.left_node + 1};
+  for (int side = 0; side < 2; ++side) {
+    index_t keep = children[side], other = children[1 - side];
+    if (nodes[other].is_leaf()) continue;
+    for (int g = 0; g < 2; ++g) {
+      index_t up = nodes[other].left_node + g;
+      index_t sibling = nodes[other].left_node + 1 - g;
+      float gain = nodes[other].bounds.area() - merged_area(keep, sibling);
+      index_t new_height = std::max(
+          1 + height[up], 2 + std::max(height[keep], height[sibling]));
+      if (gain > best_gain && (depth + new_height <= max_depth ||
+                               new_height <= height[node_idx])) {
+        best_gain = gain;
+        swap_a = keep;
+        swap_b = up;
+      }
+    }
+  }
+  if (!nodes[children[0]].is_leaf() && !nodes[children[1]].is_leaf()) {
+    index_t a = nodes[children[0]].left_node;
+    index_t a_sibling = a + 1;
+    for (int g = 0; g < 2; ++g) {
+      index_t b = nodes[children[1]].left_node + g;
+      index_t b_sibling = nodes[children[1]].left_node + 1 - g;
+      float gain = nodes[children[0]].bounds.area() +
+                   nodes[children[1]].bounds.area() -
+                   merged_area(b, a_sibling) - merged_area(a, b_sibling);
+      index_t new_height =
+          2 + std::max({height[a], height[a_sibling], height[b],
+                        height[b_sibling]});
+      if (gain > best_gain && (depth + new_height <= max_depth ||
+                               new_height <= height[node_idx])) {
+        best_gain = gain;
+        swap_a = a;
+        swap_b = b;
+      }
+    }
+  }
+  if (swap_a == invalid_index) return false;
+
+  swap_nodes(swap_a, swap_b);
+  // refit the children whose subtrees changed, then fix the heights above
+  for (index_t child : children) {
+    bvh_node& c = nodes[child];
+    if (c.is_leaf()) continue;
+    c.bounds = nodes[c.left_node].bounds;
+    c.bounds.grow(nodes[c.left_node + 1].bounds);
+    height[child] =
+        1 + std::max(height[c.left_node], height[c.left_node + 1]);
+  }
+  for (index_t n = node_idx; n != invalid_index; n = rotation.parent[n]) {
+    const bvh_node& inner = nodes[n];
+    index_t h =
+        1 + std::max(height[inner.left_node], height[inner.left_node + 1]);
+    if (h == height[n] && n != node_idx) break;
+    height[n] = h;
+  }
+  return true;
+}
+
+template <bvh_strategy Strategy>
+index_t bvh<Strategy>::optimize(float budget_ms) {
+  timer clock;
+  index_t rotations = 0;
+  if (rotation.order.empty()) start_rotation_pass();
+  while (true) {
+    // the time is checked every few nodes, reading the clock is not free
+    for (int i = 0; i < 64 && rotation.cursor < rotation.order.size(); ++i) {
+      if (rotate(rotation.order[rotation.cursor++])) {
+        rotation.rotated = true;
+        ++rotations;
+      }
+    }
+    if (rotation.cursor == rotation.order.size()) {
+      // a pass without any rotation leaves nothing to do for this call
+      bool converged = !rotation.rotated;
+      start_rotation_pass();
+      if (converged) break;
+    }
+    if (clock.elapsed() >= budget_ms) break;
+  }
+
+  // leaves moved to other slots
+  if (rotations > 0) topology.levels.clear();
+  return rotations;
 }
\ No newline at end of file
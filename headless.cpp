@@ -0,0 +1,46 @@
+#include <cstdlib>
+#include <exception>
+#include <print>
+
+#include "scenes.hpp"
+#include "surface.h"
+
+// renders the scenes of bvh without a window or an OpenGL context, for
+// machines without a display. Only links the surface library.
+
+// renders frames frames and writes the last one to image_path if it is set
+template <typename Scene>
+void render(const Scene& scene, int frames, const char* image_path) {
+  Surface canvas(Scene::width, Scene::height);
+  timer total;
+  for (int i = 0; i < frames; ++i) {
+    canvas.Clear(0xffffff);
+    scene.render(canvas);
+  }
+  std::println("{} frames in {}ms", frames, total.elapsed());
+
+  if (image_path != nullptr) {
+    canvas.SaveImage(image_path);
+    std::println("saved {}", image_path);
+  }
+}
+
+// bvh_headless [scene [depth|heatmap [frames [image.ppm|image.png]]]]
+int main(int argc, char** argv) {
+  int i = argc > 1 ? atoi(argv[1]) : 1;
+  shading mode = argc > 2 ? parse_shading(argv[2]) : shading::depth;
+  int frames = argc > 3 ? std::max(atoi(argv[3]), 1) : 1;
+  const char* image_path = argc > 4 ? argv[4] : nullptr;
+
+  try {
+    if (i == 0) {
+      render(random_scene(), frames, image_path);
+    } else {
+      render(unity_scene(mode), frames, image_path);
+    }
+  } catch (const std::exception& e) {
+    std::println("{}", e.what());
+    return 1;
+  }
+  return 0;
+}
\ No newline at end of file
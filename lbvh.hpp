@@ -0,0 +1,114 @@
+#pragma once
+
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <memory_resource>
+#include <string_view>
+#include <vector>
+
+#include "base.hpp"
+#include "morton.hpp"
+#include "parallel.hpp"
+
+// linear bvh: sorts the triangles along a morton curve and splits every
+// range at the highest bit where its first and last codes differ (Karras
+// 2012). The hierarchy is emitted top-down so siblings stay adjacent, and
+// bounds are filled bottom-up as the recursion returns.
+template <typename Code>
+struct basic_lbvh {
+  static constexpr std::string_view name =
+      sizeof(Code) == 4 ? "lbvh" : "lbvh64";
+  // largest leaf with a leaf_granularity of 1
+  static constexpr index_t min_leaf_size = 4;
+
+  basic_lbvh(const build_input& input, std::vector<bvh_node>& nodes,
+             std::vector<index_t>& indices, const build_options& options)
+      : input(input),
+        nodes(nodes),
+        indices(indices),
+        options(options),
+        // rounded up so the largest leaves fill whole simd blocks
+        leaf_size(padded_count(min_leaf_size, options.leaf_granularity)),
+        codes(input.arena) {}
+
+  // builds the whole hierarchy below the root at once
+  void split(index_t node_idx) {
+    codes = morton_codes<Code>(input.centroids, indices, options.parallel,
+                               input.arena);
+    radix_sort(codes, indices, options.parallel);
+
+    const auto& node = nodes[node_idx];
+    emit(node_idx, node.first_tri_idx, node.first_tri_idx + node.tri_count);
+  }
+
+ private:
+  void emit(index_t node_idx, index_t first, index_t last) {
+    auto& node = nodes[node_idx];
+    index_t tri_count = last - first;
+    if (tri_count <= leaf_size) {
+      node.first_tri_idx = first;
+      node.tri_count = tri_count;
+      update_bounds(node_idx);
+      return;
+    }
+
+    index_t middle = find_split(first, last);
+    index_t left_node_idx = not_used.fetch_add(2);
+    index_t right_node_idx = left_node_idx + 1;
+    node.left_node = left_node_idx;
+    node.tri_count = 0;
+
+    if (options.parallel && tri_count >= parallel_grain) {
+      parallel_invoke([=, this] { emit(left_node_idx, first, middle); },
+                      [=, this] { emit(right_node_idx, middle, last); });
+    } else {
+      emit(left_node_idx, first, middle);
+      emit(right_node_idx, middle, last);
+    }
+
+    node.bounds = nodes[left_node_idx].bounds;
+    node.bounds.grow(nodes[right_node_idx].bounds);
+  }
+
+  // first index of the right half of [first, last)
+  index_t find_split(index_t first, index_t last) const {
+    Code first_code = codes[first];
+    Code last_code = codes[last - 1];
+    if (first_code == last_code) return (first + last) / 2;
+
+    // binary search for the last code sharing more than the common prefix
+    int prefix = std::countl_zero(first_code ^ last_code);
+    index_t split = first;
+    index_t step = last - 1 - first;
+    do {
+      step = (step + 1) / 2;
+      index_t candidate = split + step;
+      if (candidate < last - 1 &&
+          std::countl_zero(first_code ^ codes[candidate]) > prefix) {
+        split = candidate;
+      }
+    } while (step > 1);
+    return split + 1;
+  }
+
+  void update_bounds(index_t node_idx) {
+    bvh_node& node = nodes[node_idx];
+    index_t end = node.first_tri_idx + node.tri_count;
+    for (index_t i = node.first_tri_idx; i < end; ++i) {
+      node.bounds.grow(input.bounds[indices[i]]);
+    }
+  }
+
+  const build_input& input;
+  std::vector<bvh_node>& nodes;
+  std::vector<index_t>& indices;
+  build_options options;
+  index_t leaf_size;
+  std::pmr::vector<Code> codes;
+
+  std::atomic<index_t> not_used = 2;
+};
+
+using lbvh = basic_lbvh<uint32_t>;
+using lbvh64 = basic_lbvh<uint64_t>;
\ No newline at end of file
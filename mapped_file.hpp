@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cstddef>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// view of a whole file mapped into memory, pages are loaded by the os on
+// first access. A copy on write mapping can be modified in memory, the
+// changes never reach the file.
+struct mapped_file {
+  explicit mapped_file(const std::string& path, bool copy_on_write = false)
+      : writable(copy_on_write) {
+#ifdef _WIN32
+    file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                       OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) fail(path);
+    LARGE_INTEGER file_size{};
+    GetFileSizeEx(file, &file_size);
+    size = static_cast<size_t>(file_size.QuadPart);
+    if (size == 0) return;
+    mapping = CreateFileMappingA(file, nullptr,
+                                 writable ? PAGE_WRITECOPY : PAGE_READONLY, 0,
+                                 0, nullptr);
+    if (mapping == nullptr) fail(path);
+    data = MapViewOfFile(mapping, writable ? FILE_MAP_COPY : FILE_MAP_READ, 0,
+                         0, 0);
+    if (data == nullptr) fail(path);
+#else
+    fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) fail(path);
+    struct stat st {};
+    if (fstat(fd, &st) != 0) fail(path);
+    size = static_cast<size_t>(st.st_size);
+    if (size == 0) return;
+    data = mmap(nullptr, size, writable ? PROT_READ | PROT_WRITE : PROT_READ,
+                MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      data = nullptr;
+      fail(path);
+    }
+#endif
+  }
+
+  mapped_file(mapped_file&& other) noexcept { swap(other); }
+  mapped_file& operator=(mapped_file&& other) noexcept {
+    mapped_file moved(std::move(other));
+    swap(moved);
+    return *this;
+  }
+  mapped_file(const mapped_file&) = delete;
+  mapped_file& operator=(const mapped_file&) = delete;
+
+  ~mapped_file() { close(); }
+
+  std::span<const std::byte> bytes() const {
+    return {static_cast<const std::byte*>(data), size};
+  }
+  // only for copy on write mappings
+  std::span<std::byte> writable_bytes() {
+    if (!writable) throw std::logic_error("mapping is read only");
+    return {static_cast<std::byte*>(data), size};
+  }
+
+ private:
+  void swap(mapped_file& other) noexcept {
+    std::swap(data, other.data);
+    std::swap(size, other.size);
+    std::swap(writable, other.writable);
+#ifdef _WIN32
+    std::swap(file, other.file);
+    std::swap(mapping, other.mapping);
+#else
+    std::swap(fd, other.fd);
+#endif
+  }
+
+  void close() {
+#ifdef _WIN32
+    if (data) UnmapViewOfFile(data);
+    if (mapping) CloseHandle(mapping);
+    if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+    file = INVALID_HANDLE_VALUE;
+    mapping = nullptr;
+#else
+    if (data) munmap(data, size);
+    if (fd >= 0) ::close(fd);
+    fd = -1;
+#endif
+    data = nullptr;
+    size = 0;
+  }
+
+  [[noreturn]] void fail(const std::string& path) {
+    close();
+    throw std::runtime_error("failed to map " + path);
+  }
+
+  void* data = nullptr;
+  size_t size = 0;
+  bool writable = false;
+#ifdef _WIN32
+  HANDLE file = INVALID_HANDLE_VALUE;
+  HANDLE mapping = nullptr;
+#else
+  int fd = -1;
+#endif
+};
\ No newline at end of file
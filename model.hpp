@@ -1,8 +1,20 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
 #include <fstream>
+#include <span>
+#include <string>
+#include <system_error>
+#include <vector>
 
 #include "base.hpp"
+#include "mapped_file.hpp"
+#include "parallel.hpp"
 
 inline triangle_list make_triangles(size_t size = 64) {
   triangle_list triangles;
@@ -20,28 +32,165 @@ inline triangle_list make_triangles(size_t size = 64) {
   return triangles;
 }
 
-inline triangle_list unity_model() {
-  std::ifstream ifs("unity.tri");
-  if (!ifs.is_open()) {
-    std::println("failed to open unity.tri");
-    throw std::runtime_error("failed to open unity.tri");
-  }
+// text file of nine floats per triangle, terminated by a triangle starting
+// with 999. The mapped file is cut into line aligned chunks that are parsed
+// in parallel, then the numbers are grouped into triangles in file order.
+inline triangle_list text_model(const std::string& path) {
+  mapped_file file(path);
+  auto bytes = file.bytes();
+  const char* text = reinterpret_cast<const char*>(bytes.data());
+  const size_t size = bytes.size();
 
-  triangle_list triangles;
-  while (true) {
-    std::array<float, 9> points{};
-    for (auto& p : points) {
-      ifs >> p;
-    }
-    if (points[0] == 999) {
-      break;
+  // numbers never span lines, so every chunk starts after a line break
+  constexpr size_t chunk_size = 1 << 20;
+  index_t chunk_count = std::max<size_t>(1, size / chunk_size);
+  auto chunk_begin = [&](index_t i) -> size_t {
+    if (i == 0) return 0;
+    if (i == chunk_count) return size;
+    const char* p = static_cast<const char*>(
+        std::memchr(text + i * chunk_size, '\n', size - i * chunk_size));
+    return p ? p - text + 1 : size;
+  };
+
+  struct chunk {
+    std::vector<float> values;
+    bool malformed = false;  // parsing stopped early at a bad number
+  };
+  std::vector<chunk> chunks(chunk_count);
+  parallel_for(
+      0, chunk_count,
+      [&](index_t first, index_t last) {
+        for (index_t i = first; i < last; ++i) {
+          const char* p = text + chunk_begin(i);
+          const char* end = text + chunk_begin(i + 1);
+          auto& values = chunks[i].values;
+          values.reserve((end - p) / 8);
+          while (true) {
+            while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' ||
+                               *p == '\n')) {
+              ++p;
+            }
+            if (p == end) break;
+            float value{};
+            auto [next, ec] = std::from_chars(p, end, value);
+            if (ec != std::errc{}) {
+              chunks[i].malformed = true;
+              break;
+            }
+            values.push_back(value);
+            p = next;
+          }
+        }
+      },
+      1);
+
+  // values of all chunks in file order, up to the terminator
+  std::vector<float> values;
+  for (const auto& c : chunks) {
+    values.insert(values.end(), c.values.begin(), c.values.end());
+    index_t tri_count = values.size() / 9;
+    bool terminated = false;
+    for (index_t i = (values.size() - c.values.size()) / 9; i < tri_count;
+         ++i) {
+      if (values[i * 9] == 999) {
+        values.resize(i * 9);
+        terminated = true;
+        break;
+      }
     }
-    float3 v0{points[0], points[1], points[2]};
-    float3 v1{points[3], points[4], points[5]};
-    float3 v2{points[6], points[7], points[8]};
-    triangles.push_back({v0, v1, v2});
+    if (terminated) break;
+    if (c.malformed) throw std::runtime_error(path + " is malformed");
   }
 
+  triangle_list triangles(values.size() / 9);
+  parallel_for(0, triangles.size(), [&](index_t first, index_t last) {
+    for (index_t i = first; i < last; ++i) {
+      const float* p = &values[i * 9];
+      triangles[i] = {
+          {p[0], p[1], p[2]}, {p[3], p[4], p[5]}, {p[6], p[7], p[8]}};
+    }
+  });
+
   std::println("loaded {} triangles", triangles.size());
   return triangles;
 }
+
+// binary triangle file: a tri_header followed by count triangles of three
+// float3, in the byte order of the machine that wrote it
+struct tri_header {
+  static constexpr std::array<char, 4> tri_magic{'B', 'T', 'R', 'I'};
+  static constexpr uint32_t current_version = 1;
+
+  std::array<char, 4> magic = tri_magic;
+  uint32_t version = current_version;
+  uint64_t count = 0;
+};
+static_assert(sizeof(tri_header) == 16 && sizeof(float3) == 12);
+
+inline void write_tri_file(const std::string& path,
+                           const triangle_list& triangles) {
+  std::ofstream ofs(path, std::ios::binary);
+  if (!ofs.is_open()) throw std::runtime_error("failed to create " + path);
+
+  tri_header header;
+  header.count = triangles.size();
+  ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  for (const auto& tri : triangles) {
+    std::array<float3, 3> v{tri.vertex0, tri.vertex1, tri.vertex2};
+    ofs.write(reinterpret_cast<const char*>(v.data()), sizeof(v));
+  }
+  if (!ofs) throw std::runtime_error("failed to write " + path);
+}
+
+// a mapped binary triangle file, the vertices are used in place
+struct tri_file {
+  explicit tri_file(const std::string& path) : file(path) {
+    auto bytes = file.bytes();
+    tri_header header;
+    if (bytes.size() < sizeof(header)) {
+      throw std::runtime_error(path + " is not a triangle file");
+    }
+    std::memcpy(&header, bytes.data(), sizeof(header));
+    if (header.magic != tri_header::tri_magic) {
+      throw std::runtime_error(path + " is not a triangle file");
+    }
+    if (header.version != tri_header::current_version) {
+      throw std::runtime_error(std::format("{} has version {}, expected {}",
+                                           path, header.version,
+                                           tri_header::current_version));
+    }
+    if (bytes.size() != sizeof(header) + header.count * 3 * sizeof(float3)) {
+      throw std::runtime_error(path + " is truncated");
+    }
+    verts = {reinterpret_cast<const float3*>(bytes.data() + sizeof(header)),
+             header.count * 3};
+  }
+
+  index_t size() const { return verts.size() / 3; }
+  // vertex0, vertex1 and vertex2 of every triangle in turn
+  std::span<const float3> vertices() const { return verts; }
+  // builds and traverses a bvh straight from the mapping
+  mesh_view mesh() const { return mesh_view(verts); }
+
+  triangle_list triangles() const {
+    triangle_list triangles(size());
+    for (index_t i = 0; i < size(); ++i) {
+      triangles[i] = {verts[3 * i], verts[3 * i + 1], verts[3 * i + 2]};
+    }
+    return triangles;
+  }
+
+ private:
+  mapped_file file;
+  std::span<const float3> verts;
+};
+
+// prefers the binary unity.trib written by tri_convert over the text file
+inline triangle_list unity_model() {
+  if (std::filesystem::exists("unity.trib")) {
+    auto triangles = tri_file("unity.trib").triangles();
+    std::println("loaded {} triangles", triangles.size());
+    return triangles;
+  }
+  return text_model("unity.tri");
+}
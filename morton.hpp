@@ -0,0 +1,169 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <memory_resource>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "base.hpp"
+#include "parallel.hpp"
+
+// spreads the lower 10 bits of v so that there are two zero bits between
+// each of them
+inline uint32_t expand_bits(uint32_t v) {
+  v &= 0x3ffu;
+  v = (v | (v << 16)) & 0x030000ffu;
+  v = (v | (v << 8)) & 0x0300f00fu;
+  v = (v | (v << 4)) & 0x030c30c3u;
+  v = (v | (v << 2)) & 0x09249249u;
+  return v;
+}
+
+// same for the lower 21 bits of v
+inline uint64_t expand_bits(uint64_t v) {
+  v &= 0x1fffffull;
+  v = (v | (v << 32)) & 0x001f00000000ffffull;
+  v = (v | (v << 16)) & 0x001f0000ff0000ffull;
+  v = (v | (v << 8)) & 0x100f00f00f00f00full;
+  v = (v | (v << 4)) & 0x10c30c30c30c30c3ull;
+  v = (v | (v << 2)) & 0x1249249249249249ull;
+  return v;
+}
+
+// 30 bit (uint32_t) or 63 bit (uint64_t) morton code of a point in [0, 1]^3
+template <typename Code>
+Code morton_code(const float3& p) {
+  constexpr float scale = sizeof(Code) == 4 ? 1024.0f : 2097152.0f;
+  auto quantize = [](float v) {
+    return static_cast<Code>(std::clamp(v * scale, 0.0f, scale - 1));
+  };
+  return (expand_bits(quantize(p.x)) << 2) |
+         (expand_bits(quantize(p.y)) << 1) | expand_bits(quantize(p.z));
+}
+
+// morton codes of the triangle centroids referenced by indices, allocated
+// from resource
+template <typename Code>
+std::pmr::vector<Code> morton_codes(
+    std::span<const float3> centroids, const std::vector<index_t>& indices,
+    bool parallel,
+    std::pmr::memory_resource* resource = std::pmr::get_default_resource()) {
+  auto centroid_bounds = [&](index_t first, index_t last, aabb b) {
+    for (index_t i = first; i < last; ++i) {
+      b.grow(centroids[indices[i]]);
+    }
+    return b;
+  };
+
+  index_t count = indices.size();
+  aabb bounds;
+  if (parallel) {
+    bounds = parallel_reduce(0, count, bounds, centroid_bounds,
+                             [](aabb a, const aabb& b) {
+                               a.grow(b);
+                               return a;
+                             });
+  } else {
+    bounds = centroid_bounds(0, count, bounds);
+  }
+
+  float3 extent = bounds.extent();
+  float3 scale(extent.x > 0 ? 1 / extent.x : 0, extent.y > 0 ? 1 / extent.y : 0,
+               extent.z > 0 ? 1 / extent.z : 0);
+
+  std::pmr::vector<Code> codes(count, resource);
+  auto encode = [&](index_t first, index_t last) {
+    for (index_t i = first; i < last; ++i) {
+      float3 p = (centroids[indices[i]] - bounds.min) * scale;
+      codes[i] = morton_code<Code>(p);
+    }
+  };
+  if (parallel) {
+    parallel_for(0, count, encode);
+  } else {
+    encode(0, count);
+  }
+  return codes;
+}
+
+// sorts keys ascending and applies the same permutation to values, using a
+// least significant digit radix sort over 8 bit digits. Every pass counts
+// the digits of fixed size chunks in parallel, then scatters the chunks in
+// parallel to the offsets given by the prefix sum of the counts. The
+// scratch buffers come from the allocator of keys.
+template <typename Code>
+void radix_sort(std::pmr::vector<Code>& keys, std::vector<index_t>& values,
+                bool parallel) {
+  constexpr int digit_bits = 8;
+  constexpr int bucket_count = 1 << digit_bits;
+  constexpr int pass_count = (sizeof(Code) * 8 + digit_bits - 1) / digit_bits;
+  constexpr index_t chunk_size = parallel_grain * 4;
+  using histogram = std::array<index_t, bucket_count>;
+
+  index_t count = keys.size();
+  index_t chunk_count = (count + chunk_size - 1) / chunk_size;
+  auto* resource = keys.get_allocator().resource();
+  std::pmr::vector<histogram> offsets(chunk_count, resource);
+  std::pmr::vector<Code> keys_tmp(count, resource);
+  std::pmr::vector<index_t> values_tmp(count, resource);
+  // every pass scatters from in to out, then the two swap roles
+  std::span<Code> keys_in = keys, keys_out = keys_tmp;
+  std::span<index_t> values_in = values, values_out = values_tmp;
+
+  auto for_each_chunk = [&](auto&& func) {
+    auto chunks = [&](index_t first, index_t last) {
+      for (index_t c = first; c < last; ++c) {
+        func(c, c * chunk_size, std::min(count, (c + 1) * chunk_size));
+      }
+    };
+    if (parallel) {
+      parallel_for(0, chunk_count, chunks, 1);
+    } else {
+      chunks(0, chunk_count);
+    }
+  };
+
+  for (int pass = 0; pass < pass_count; ++pass) {
+    int shift = pass * digit_bits;
+    auto digit = [shift](Code key) {
+      return static_cast<index_t>(key >> shift) & (bucket_count - 1);
+    };
+
+    for_each_chunk([&](index_t c, index_t first, index_t last) {
+      histogram& h = offsets[c];
+      h.fill(0);
+      for (index_t i = first; i < last; ++i) ++h[digit(keys_in[i])];
+    });
+
+    // exclusive prefix sum in (digit, chunk) order keeps the sort stable
+    index_t sum = 0;
+    for (int d = 0; d < bucket_count; ++d) {
+      for (auto& h : offsets) {
+        index_t n = h[d];
+        h[d] = sum;
+        sum += n;
+      }
+    }
+
+    for_each_chunk([&](index_t c, index_t first, index_t last) {
+      histogram& h = offsets[c];
+      for (index_t i = first; i < last; ++i) {
+        index_t dst = h[digit(keys_in[i])]++;
+        keys_out[dst] = keys_in[i];
+        values_out[dst] = values_in[i];
+      }
+    });
+
+    std::swap(keys_in, keys_out);
+    std::swap(values_in, values_out);
+  }
+
+  // an odd pass count leaves the result in the scratch buffers
+  if (keys_in.data() != keys.data()) {
+    std::ranges::copy(keys_in, keys.begin());
+    std::ranges::copy(values_in, values.begin());
+  }
+}
\ No newline at end of file
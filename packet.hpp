@@ -0,0 +1,151 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+
+#include "base.hpp"
+#include "simd.hpp"
+
+// N coherent rays in structure of arrays form, traversed together
+template <int N>
+struct alignas(64) ray_packet {
+  static_assert(N == 4 || N == 8 || N == 16, "packets hold 4, 8 or 16 rays");
+  // lanes per simd operation and simd operations per packet
+  static constexpr int lanes = std::min(N, simd_width);
+  static constexpr int groups = N / lanes;
+  static constexpr uint32_t all = (1u << N) - 1;
+
+  void set(int i, const ray& r) {
+    origin_x[i] = r.origin.x;
+    origin_y[i] = r.origin.y;
+    origin_z[i] = r.origin.z;
+    direction_x[i] = r.direction.x;
+    direction_y[i] = r.direction.y;
+    direction_z[i] = r.direction.z;
+    r_direction_x[i] = r.r_direction.x;
+    r_direction_y[i] = r.r_direction.y;
+    r_direction_z[i] = r.r_direction.z;
+    t[i] = r.t;
+    u[i] = r.u;
+    v[i] = r.v;
+    prim[i] = r.prim;
+  }
+
+  vfloat3<lanes> origin(int g) const {
+    return {vfloat<lanes>::load(&origin_x[g * lanes]),
+            vfloat<lanes>::load(&origin_y[g * lanes]),
+            vfloat<lanes>::load(&origin_z[g * lanes])};
+  }
+  vfloat3<lanes> direction(int g) const {
+    return {vfloat<lanes>::load(&direction_x[g * lanes]),
+            vfloat<lanes>::load(&direction_y[g * lanes]),
+            vfloat<lanes>::load(&direction_z[g * lanes])};
+  }
+  vfloat3<lanes> r_direction(int g) const {
+    return {vfloat<lanes>::load(&r_direction_x[g * lanes]),
+            vfloat<lanes>::load(&r_direction_y[g * lanes]),
+            vfloat<lanes>::load(&r_direction_z[g * lanes])};
+  }
+
+  std::array<float, N> origin_x, origin_y, origin_z;
+  std::array<float, N> direction_x, direction_y, direction_z;
+  std::array<float, N> r_direction_x, r_direction_y, r_direction_z;
+  std::array<float, N> t;
+  // hit record, see ray
+  std::array<float, N> u, v;
+  std::array<index_t, N> prim;
+  // rays to trace, the others are left untouched
+  uint32_t active = all;
+#ifdef BVH_STATS
+  ray_stats stats;  // of the whole packet
+#endif
+};
+
+// returns the mask of the rays in active hitting the box and the smallest
+// entry distance among them in dist, 1e30f if none does
+template <int N>
+uint32_t intersect_box(const aabb& box, const ray_packet<N>& p, float& dist,
+                       uint32_t active = ray_packet<N>::all) {
+  using vf = vfloat<ray_packet<N>::lanes>;
+  constexpr int lanes = ray_packet<N>::lanes;
+
+  uint32_t mask = 0;
+  dist = 1e30f;
+  for (int g = 0; g < ray_packet<N>::groups; ++g) {
+    uint32_t group_active = (active >> (g * lanes)) & ((1u << lanes) - 1);
+    if (group_active == 0) continue;
+
+    auto o = p.origin(g);
+    auto rd = p.r_direction(g);
+    vf tx1 = (vf(box.min.x) - o.x) * rd.x, tx2 = (vf(box.max.x) - o.x) * rd.x;
+    vf ty1 = (vf(box.min.y) - o.y) * rd.y, ty2 = (vf(box.max.y) - o.y) * rd.y;
+    vf tz1 = (vf(box.min.z) - o.z) * rd.z, tz2 = (vf(box.max.z) - o.z) * rd.z;
+    vf tmin = max(max(min(tx1, tx2), min(ty1, ty2)), min(tz1, tz2));
+    vf tmax = min(min(max(tx1, tx2), max(ty1, ty2)), max(tz1, tz2));
+    auto hit = (tmax >= tmin) & (tmin < vf::load(&p.t[g * lanes])) &
+               (tmax > vf(0.0f));
+    uint32_t hits = static_cast<uint32_t>(hit.mask()) & group_active;
+    if (hits == 0) continue;
+
+    alignas(32) std::array<float, lanes> near;
+    tmin.store(near.data());
+    mask |= hits << (g * lanes);
+    for (; hits != 0; hits &= hits - 1) {
+      dist = std::min(dist, near[std::countr_zero(hits)]);
+    }
+  }
+  return mask;
+}
+
+// moller-trumbore for the rays in mask against one triangle
+template <int N>
+void intersect_tri(const triangle& tri, ray_packet<N>& p, uint32_t mask,
+                   index_t prim = invalid_index) {
+  using vf = vfloat<ray_packet<N>::lanes>;
+  using vf3 = vfloat3<ray_packet<N>::lanes>;
+  constexpr int lanes = ray_packet<N>::lanes;
+
+  float3 edge1 = tri.vertex1 - tri.vertex0;
+  float3 edge2 = tri.vertex2 - tri.vertex0;
+  const vf3 e1(edge1.x, edge1.y, edge1.z);
+  const vf3 e2(edge2.x, edge2.y, edge2.z);
+  const vf3 v0(tri.vertex0.x, tri.vertex0.y, tri.vertex0.z);
+  const vf zero(0.0f), one(1.0f), eps(1e-4f);
+  // is_parallel, the normal is shared by all rays
+  float3 n = cross(edge1, edge2);
+  const vf min_det2(parallel_cos * parallel_cos * dot(n, n));
+
+  for (int g = 0; g < ray_packet<N>::groups; ++g) {
+    if (((mask >> (g * lanes)) & ((1u << lanes) - 1)) == 0) continue;
+
+    vf3 d = p.direction(g);
+    vf3 pv = cross(d, e2);
+    vf det = dot(e1, pv);
+    vf inv_det = one / det;
+    vf3 tvec = p.origin(g) - v0;
+    vf u = dot(tvec, pv) * inv_det;
+    vf3 q = cross(tvec, e1);
+    vf v = dot(d, q) * inv_det;
+    vf tt = dot(e2, q) * inv_det;
+
+    vf t = vf::load(&p.t[g * lanes]);
+    auto hit = (det * det > min_det2) & (u >= zero) & (u <= one) & (v >= zero) &
+               (u + v <= one) & (tt > eps) & (tt < t);
+    int lane_mask = hit.mask() & static_cast<int>(mask >> (g * lanes));
+    if (lane_mask == 0) continue;
+
+    alignas(32) std::array<float, lanes> hit_t, hit_u, hit_v;
+    tt.store(hit_t.data());
+    u.store(hit_u.data());
+    v.store(hit_v.data());
+    for (int i = 0; i < lanes; ++i) {
+      if ((lane_mask & (1 << i)) == 0) continue;
+      p.t[g * lanes + i] = hit_t[i];
+      p.u[g * lanes + i] = hit_u[i];
+      p.v[g * lanes + i] = hit_v[i];
+      p.prim[g * lanes + i] = prim;
+    }
+  }
+}
\ No newline at end of file
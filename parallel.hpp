@@ -0,0 +1,55 @@
+#pragma once
+
+#include <utility>
+
+#ifdef BVH_HAS_TBB
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_invoke.h>
+#include <tbb/parallel_reduce.h>
+#endif
+
+#include "base.hpp"
+
+// ranges smaller than this are processed on the calling thread
+constexpr index_t parallel_grain = 4096;
+
+template <typename F0, typename F1>
+void parallel_invoke(F0&& f0, F1&& f1) {
+#ifdef BVH_HAS_TBB
+  tbb::parallel_invoke(std::forward<F0>(f0), std::forward<F1>(f1));
+#else
+  f0();
+  f1();
+#endif
+}
+
+// calls func(first, last) on sub ranges of [begin, end)
+template <typename Func>
+void parallel_for(index_t begin, index_t end, Func&& func,
+                  [[maybe_unused]] index_t grain = parallel_grain) {
+#ifdef BVH_HAS_TBB
+  tbb::parallel_for(
+      tbb::blocked_range<index_t>(begin, end, grain),
+      [&](const tbb::blocked_range<index_t>& r) { func(r.begin(), r.end()); });
+#else
+  func(begin, end);
+#endif
+}
+
+// value = func(first, last, value) on sub ranges of [begin, end), partial
+// values are merged with reduce(a, b)
+template <typename T, typename Func, typename Reduce>
+T parallel_reduce(index_t begin, index_t end, const T& identity, Func&& func,
+                  [[maybe_unused]] Reduce&& reduce) {
+#ifdef BVH_HAS_TBB
+  return tbb::parallel_reduce(
+      tbb::blocked_range<index_t>(begin, end, parallel_grain), identity,
+      [&](const tbb::blocked_range<index_t>& r, T value) {
+        return func(r.begin(), r.end(), std::move(value));
+      },
+      reduce);
+#else
+  return func(begin, end, identity);
+#endif
+}
\ No newline at end of file
@@ -0,0 +1,255 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <execution>
+#include <memory_resource>
+#include <string_view>
+#include <vector>
+
+#include "base.hpp"
+#include "morton.hpp"
+#include "parallel.hpp"
+
+// parallel locally-ordered clustering (Meister and Bittner 2018): starts
+// from one cluster per triangle in morton order, then repeatedly merges
+// every pair of clusters that are each other's nearest neighbour within
+// search_radius positions, until a single cluster is left. A bottom-up
+// pass then collapses every subtree that is cheaper as a single leaf, or
+// that is too deep to traverse.
+struct ploc {
+  static constexpr std::string_view name = "ploc";
+  static constexpr index_t search_radius = 16;
+  static constexpr index_t max_leaf_size = 16;
+  // keeps the deepest path within the traversal stack of bvh::intersect
+  static constexpr index_t max_depth = 48;
+
+  ploc(const build_input& input, std::vector<bvh_node>& nodes,
+       std::vector<index_t>& indices, const build_options& options)
+      : input(input), nodes(nodes), indices(indices), options(options) {}
+
+  // builds the whole hierarchy below the root at once
+  void split(index_t node_idx) {
+    auto codes = morton_codes<uint32_t>(input.centroids, indices,
+                                        options.parallel, input.arena);
+    radix_sort(codes, indices, options.parallel);
+
+    const auto& root = nodes[node_idx];
+    if (root.tri_count == 0) return;
+
+    std::pmr::vector<bvh_node> clusters(root.tri_count, input.arena);
+    for_each(0, root.tri_count, [&](index_t i) {
+      auto& leaf = clusters[i];
+      leaf.first_tri_idx = root.first_tri_idx + i;
+      leaf.tri_count = 1;
+      leaf.bounds = input.bounds[indices[leaf.first_tri_idx]];
+    });
+
+    std::pmr::vector<index_t> neighbours(input.arena);
+    while (clusters.size() > 1) {
+      find_neighbours(clusters, neighbours);
+      merge(clusters, neighbours);
+    }
+    // root is overwritten below
+    index_t first = root.first_tri_idx;
+    std::pmr::vector<index_t> reordered(input.arena);
+    reordered.reserve(root.tri_count);
+    nodes[node_idx] = clusters[0];
+    collapse(node_idx, first, reordered);
+    std::copy(reordered.begin(), reordered.end(), indices.begin() + first);
+    compact(node_idx);
+  }
+
+ private:
+  // marks a cluster that was merged into its neighbour
+  static constexpr index_t merged = max_v<index_t>;
+
+  template <typename Func>
+  void for_each(index_t begin, index_t end, Func&& func) const {
+    auto body = [&](index_t first, index_t last) {
+      for (index_t i = first; i < last; ++i) func(i);
+    };
+    if (options.parallel) {
+      parallel_for(begin, end, body);
+    } else {
+      body(begin, end);
+    }
+  }
+
+  static float merged_area(const bvh_node& a, const bvh_node& b) {
+    aabb box = a.bounds;
+    box.grow(b.bounds);
+    return box.area();
+  }
+
+  void find_neighbours(const std::pmr::vector<bvh_node>& clusters,
+                       std::pmr::vector<index_t>& neighbours) const {
+    index_t count = clusters.size();
+    neighbours.resize(count);
+    for_each(0, count, [&](index_t i) {
+      index_t first = i > search_radius ? i - search_radius : 0;
+      index_t last = std::min(count, i + search_radius + 1);
+      float best_area = infinity_v<float>;
+      index_t best = i;
+      for (index_t j = first; j < last; ++j) {
+        if (j == i) continue;
+        float area = merged_area(clusters[i], clusters[j]);
+        if (area < best_area) {
+          best_area = area;
+          best = j;
+        }
+      }
+      neighbours[i] = best;
+    });
+  }
+
+  void merge(std::pmr::vector<bvh_node>& clusters,
+             const std::pmr::vector<index_t>& neighbours) {
+    index_t count = clusters.size();
+    std::atomic<index_t> merge_count = 0;
+    for_each(0, count, [&](index_t i) {
+      index_t j = neighbours[i];
+      if (neighbours[j] != i || j < i) return;
+
+      // siblings are copied out of the cluster list into an adjacent pair
+      index_t left_node_idx = not_used.fetch_add(2);
+      nodes[left_node_idx] = clusters[i];
+      nodes[left_node_idx + 1] = clusters[j];
+
+      bvh_node& parent = clusters[i];
+      parent.bounds.grow(clusters[j].bounds);
+      parent.left_node = left_node_idx;
+      parent.tri_count = 0;
+      clusters[j].tri_count = merged;
+      merge_count.fetch_add(1, std::memory_order_relaxed);
+    });
+
+    // the globally closest pair is always mutual, this only guards against
+    // ties that the nearest neighbour search broke inconsistently
+    if (merge_count == 0) {
+      index_t left_node_idx = not_used.fetch_add(2);
+      nodes[left_node_idx] = clusters[0];
+      nodes[left_node_idx + 1] = clusters[1];
+      clusters[0].bounds.grow(clusters[1].bounds);
+      clusters[0].left_node = left_node_idx;
+      clusters[0].tri_count = 0;
+      clusters[1].tri_count = merged;
+    }
+
+    auto is_merged = [](const bvh_node& c) { return c.tri_count == merged; };
+    auto end = options.parallel ? std::remove_if(std::execution::par,
+                                                 clusters.begin(),
+                                                 clusters.end(), is_merged)
+                                : std::remove_if(clusters.begin(),
+                                                 clusters.end(), is_merged);
+    clusters.erase(end, clusters.end());
+  }
+
+  // the merges above leave the triangles of a subtree scattered over the
+  // indices. Appends them to reordered in depth first order, so every
+  // subtree covers a contiguous range starting at first, and turns the
+  // subtree into a leaf where its sah cost is not lower than that of a leaf.
+  // Costs count box and triangle tests as 1. Subtrees below max_depth are
+  // turned into a leaf whatever their cost, degenerate inputs can cluster
+  // into chains as deep as they have triangles.
+  void collapse(index_t node_idx, index_t first,
+                std::pmr::vector<index_t>& reordered) {
+    // a node is visited again once both children are collapsed
+    struct entry {
+      index_t node_idx;
+      index_t depth;
+      index_t begin = 0;  // size of reordered before the subtree
+      bool visited = false;
+    };
+    std::pmr::vector<entry> stack({{node_idx, 0}}, input.arena);
+    std::pmr::vector<float> costs(input.arena);  // of the collapsed subtrees
+    while (!stack.empty()) {
+      entry current = stack.back();
+      bvh_node& node = nodes[current.node_idx];
+      if (!current.visited) {
+        if (!node.is_leaf() && current.depth < max_depth) {
+          stack.back() = {current.node_idx, current.depth,
+                          index_t(reordered.size()), true};
+          stack.push_back({node.left_node + 1, current.depth + 1});
+          stack.push_back({node.left_node, current.depth + 1});
+          continue;
+        }
+        stack.pop_back();
+        index_t begin = reordered.size();
+        gather(current.node_idx, reordered);
+        node.first_tri_idx = first + begin;
+        node.tri_count = reordered.size() - begin;
+        costs.push_back(leaf_cost(node.bounds, node.tri_count));
+        continue;
+      }
+
+      stack.pop_back();
+      float children_cost = costs.back();
+      costs.pop_back();
+      children_cost += costs.back();
+      costs.pop_back();
+      float inner_cost = 2 * node.bounds.area() + children_cost;
+      index_t count = reordered.size() - current.begin;
+      float cost = leaf_cost(node.bounds, count);
+      if (count > max_leaf_size || cost > inner_cost) {
+        costs.push_back(inner_cost);
+        continue;
+      }
+
+      // the child slots stay behind unused
+      node.first_tri_idx = first + current.begin;
+      node.tri_count = count;
+      costs.push_back(cost);
+    }
+  }
+
+  // appends the triangles of the subtree below node_idx in depth first order
+  void gather(index_t node_idx, std::pmr::vector<index_t>& reordered) const {
+    std::pmr::vector<index_t> stack({node_idx}, input.arena);
+    while (!stack.empty()) {
+      const bvh_node& node = nodes[stack.back()];
+      stack.pop_back();
+      if (node.is_leaf()) {
+        auto leaf_begin = indices.begin() + node.first_tri_idx;
+        reordered.insert(reordered.end(), leaf_begin,
+                         leaf_begin + node.tri_count);
+        continue;
+      }
+      stack.push_back(node.left_node + 1);
+      stack.push_back(node.left_node);
+    }
+  }
+
+  // collapsed subtrees leave their nodes behind, moves the reachable ones
+  // to the front in depth first order
+  void compact(index_t node_idx) {
+    std::pmr::vector<bvh_node> old(nodes.begin(), nodes.begin() + not_used,
+                                   input.arena);
+    index_t next = 2;
+    std::pmr::vector<index_t> stack({node_idx}, input.arena);
+    while (!stack.empty()) {
+      bvh_node& node = nodes[stack.back()];
+      stack.pop_back();
+      if (node.is_leaf()) continue;
+      nodes[next] = old[node.left_node];
+      nodes[next + 1] = old[node.left_node + 1];
+      node.left_node = next;
+      stack.push_back(next + 1);
+      stack.push_back(next);
+      next += 2;
+    }
+    not_used = next;
+  }
+
+  float leaf_cost(const aabb& bounds, index_t count) const {
+    return bounds.area() * padded_count(count, options.leaf_granularity);
+  }
+
+  const build_input& input;
+  std::vector<bvh_node>& nodes;
+  std::vector<index_t>& indices;
+  build_options options;
+
+  std::atomic<index_t> not_used = 2;
+};
\ No newline at end of file
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <algorithm>
+#include <format>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "base.hpp"
+
+// structure of a built tree, to compare strategies independent of the
+// machine they run on
+struct bvh_quality {
+  // sah cost of the tree relative to the root surface area: the expected
+  // number of box tests plus triangle tests for a random ray that hits the
+  // root, with both costing 1
+  float sah_cost = 0;
+  index_t inner_nodes = 0;
+  index_t leaves = 0;
+  index_t references = 0;  // triangles in all leaves, sbvh duplicates some
+  // slots of nodes that are not reachable from the root, including slot 1
+  index_t unused_nodes = 0;
+  // sum of the areas where the two children of a node overlap, divided by
+  // the sum of the areas of those nodes
+  float sibling_overlap = 0;
+  float average_leaf_depth = 0;
+  std::vector<index_t> leaf_depths;  // leaves per depth
+  std::vector<index_t> leaf_sizes;   // leaves per triangle count
+
+  std::string print() const {
+    std::string s = std::format(
+        "sah cost {:.3f}, {} inner nodes, {} leaves, {} references, {} "
+        "unused nodes, sibling overlap {:.4f}, average leaf depth {:.2f}",
+        sah_cost, inner_nodes, leaves, references, unused_nodes,
+        sibling_overlap, average_leaf_depth);
+    s += "\nleaves per depth:";
+    for (size_t i = 0; i < leaf_depths.size(); ++i) {
+      if (leaf_depths[i] > 0) s += std::format(" {}:{}", i, leaf_depths[i]);
+    }
+    s += "\nleaves per size:";
+    for (size_t i = 0; i < leaf_sizes.size(); ++i) {
+      if (leaf_sizes[i] > 0) s += std::format(" {}:{}", i, leaf_sizes[i]);
+    }
+    return s;
+  }
+};
+
+// area of the box both a and b cover, 0 if they are disjoint
+float inline overlap_area(const aabb& a, const aabb& b) {
+  float3 e = min(a.max, b.max) - max(a.min, b.min);
+  if (e.x <= 0 || e.y <= 0 || e.z <= 0) return 0;
+  return e.x * e.y + e.y * e.z + e.z * e.x;
+}
+
+// walks the nodes reachable from the root, see bvh::get_nodes
+bvh_quality inline analyze(std::span<const bvh_node> nodes) {
+  bvh_quality q;
+  if (nodes.empty()) return q;
+
+  double inner_area = 0, overlap = 0;
+  double leaf_cost = 0, depth_sum = 0;
+  std::vector<std::pair<index_t, index_t>> stack{{0, 0}};  // node, depth
+  while (!stack.empty()) {
+    auto [node_idx, depth] = stack.back();
+    stack.pop_back();
+    const bvh_node& node = nodes[node_idx];
+    if (node.is_leaf()) {
+      ++q.leaves;
+      q.references += node.tri_count;
+      leaf_cost += node.cost();
+      depth_sum += depth;
+      if (q.leaf_depths.size() <= depth) q.leaf_depths.resize(depth + 1);
+      ++q.leaf_depths[depth];
+      if (q.leaf_sizes.size() <= node.tri_count) {
+        q.leaf_sizes.resize(node.tri_count + 1);
+      }
+      ++q.leaf_sizes[node.tri_count];
+      continue;
+    }
+
+    ++q.inner_nodes;
+    const bvh_node& left = nodes[node.left_node];
+    const bvh_node& right = nodes[node.left_node + 1];
+    inner_area += node.bounds.area();
+    overlap += overlap_area(left.bounds, right.bounds);
+    stack.push_back({node.left_node, depth + 1});
+    stack.push_back({node.left_node + 1, depth + 1});
+  }
+
+  float root_area = nodes[0].bounds.area();
+  // every inner node costs the box tests of its two children
+  if (root_area > 0) q.sah_cost = (2 * inner_area + leaf_cost) / root_area;
+  if (inner_area > 0) q.sibling_overlap = overlap / inner_area;
+  q.average_leaf_depth = depth_sum / q.leaves;
+  q.unused_nodes = nodes.size() - q.inner_nodes - q.leaves;
+  return q;
+}
\ No newline at end of file
@@ -1,45 +1,55 @@
 #pragma once
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <execution>
+#include <memory_resource>
 #include <print>
+#include <string_view>
 #include <tuple>
 #include <utility>
 #include <vector>
 
 #include "base.hpp"
+#include "parallel.hpp"
 
+// candidate generators replace the contents of candidates, which is reused
+// for every axis of a node
 struct split_point_uniform {
-  static std::vector<float> candidates(const bvh_node& node, int axis,
-                                       triangle_list&, std::vector<index_t>&) {
+  static void candidates(const bvh_node& node, int axis, const build_input&,
+                         std::vector<index_t>&,
+                         std::pmr::vector<float>& candidates) {
     int size = 4;  // std::min(index_t(4), node.tri_count);
     float scale = node.bounds.extent(axis) / size;
-    std::vector<float> candidates(size);
+    candidates.resize(size);
     std::generate_n(candidates.begin(), size,
                     [scale, cnt = 0, base = node.bounds.min[axis]]() mutable {
                       return base + scale * cnt++;
                     });
-    return candidates;
   }
 };
 
 struct split_point_centroid {
-  static std::vector<float> candidates(const bvh_node& node, int axis,
-                                       triangle_list& triangles,
-                                       std::vector<index_t>& indices) {
-    std::vector<float> candidates(node.tri_count);
+  static void candidates(const bvh_node& node, int axis,
+                         const build_input& input,
+                         std::vector<index_t>& indices,
+                         std::pmr::vector<float>& candidates) {
+    candidates.resize(node.tri_count);
     index_t end = node.first_tri_idx + node.tri_count;
     for (index_t i = node.first_tri_idx; i < end; ++i) {
-      auto& tri = triangles[indices[i]];
-      candidates[i - node.first_tri_idx] = tri.centroid[axis];
+      candidates[i - node.first_tri_idx] = input.centroids[indices[i]][axis];
     }
-    return candidates;
   }
 };
 
 struct sah {
-  sah(triangle_list& tris, std::vector<bvh_node>& nodes,
-      std::vector<index_t>& indices)
-      : triangles(tris), nodes(nodes), indices(indices) {}
+  static constexpr std::string_view name = "sah";
+
+  sah(const build_input& input, std::vector<bvh_node>& nodes,
+      std::vector<index_t>& indices, const build_options& options)
+      : input(input), nodes(nodes), indices(indices), options(options) {}
 
   void split(index_t node_idx) {
     auto& node = nodes[node_idx];
@@ -48,13 +58,13 @@ struct sah {
     // compute split axis and position
     const auto [split_axis, split_pos, best_cost] = split_point(node_idx);
 
-    if (best_cost >= node.cost()) return;
+    if (best_cost >= leaf_cost(node)) return;
 
     // split triangles into two halves
     index_t left = node.first_tri_idx;
     index_t right = left + node.tri_count - 1;
     while (left <= right) {
-      if (triangles[indices[left]].centroid[split_axis] < split_pos) {
+      if (input.centroids[indices[left]][split_axis] < split_pos) {
         ++left;
       } else {
         std::swap(indices[left], indices[right--]);
@@ -65,28 +75,31 @@ struct sah {
     index_t left_count = left - node.first_tri_idx;
     if (left_count == 0 || left_count == node.tri_count) return;
 
-    index_t left_node_idx = not_used++;
-    index_t right_node_idx = not_used++;
+    index_t tri_count = node.tri_count;
+    index_t left_node_idx = not_used.fetch_add(2);
+    index_t right_node_idx = left_node_idx + 1;
     nodes[left_node_idx].first_tri_idx = node.first_tri_idx;
     nodes[left_node_idx].tri_count = left_count;
     nodes[right_node_idx].first_tri_idx = left;
-    nodes[right_node_idx].tri_count = node.tri_count - left_count;
+    nodes[right_node_idx].tri_count = tri_count - left_count;
 
     node.left_node = left_node_idx;
     node.tri_count = 0;
 
-    split(left_node_idx);
-    split(right_node_idx);
+    if (options.parallel && tri_count >= parallel_grain) {
+      parallel_invoke([=, this] { split(left_node_idx); },
+                      [=, this] { split(right_node_idx); });
+    } else {
+      split(left_node_idx);
+      split(right_node_idx);
+    }
   }
 
   void update_bounds(index_t node_idx) {
     bvh_node& node = nodes[node_idx];
     index_t end = node.first_tri_idx + node.tri_count;
     for (index_t i = node.first_tri_idx; i < end; ++i) {
-      auto& tri = triangles[indices[i]];
-      node.bounds.grow(tri.vertex0);
-      node.bounds.grow(tri.vertex1);
-      node.bounds.grow(tri.vertex2);
+      node.bounds.grow(input.bounds[indices[i]]);
     }
   }
 
@@ -95,9 +108,13 @@ struct sah {
     int best_axis = -1;
     float best_pos = 0.0f;
     float best_cost = max_v<float>;
+    // small candidate sets stay on the stack, split runs on many threads at
+    // once so a shared arena would need locking
+    std::array<std::byte, 256> buffer;
+    std::pmr::monotonic_buffer_resource arena(buffer.data(), buffer.size());
+    std::pmr::vector<float> candidates(&arena);
     for (int axis = 0; axis < 3; ++axis) {
-      const auto candidates =
-          split_point_uniform::candidates(node, axis, triangles, indices);
+      split_point_uniform::candidates(node, axis, input, indices, candidates);
       for (const auto pos : candidates) {
         float cost = sah_cost(node, axis, pos);
         if (cost < best_cost) {
@@ -117,26 +134,252 @@ struct sah {
     index_t i = node.first_tri_idx;
     index_t end = node.first_tri_idx + node.tri_count;
     for (; i < end; ++i) {
-      const auto& tri = triangles[indices[i]];
-      if (tri.centroid[axis] < pos) {
+      index_t tri = indices[i];
+      if (input.centroids[tri][axis] < pos) {
         ++left_cnt;
-        left_box.grow(tri.vertex0);
-        left_box.grow(tri.vertex1);
-        left_box.grow(tri.vertex2);
+        left_box.grow(input.bounds[tri]);
       } else {
         ++right_cnt;
-        right_box.grow(tri.vertex0);
-        right_box.grow(tri.vertex1);
-        right_box.grow(tri.vertex2);
+        right_box.grow(input.bounds[tri]);
       }
     }
-    float cost = left_cnt * left_box.area() + right_cnt * right_box.area();
+    float cost = padded_count(left_cnt, options.leaf_granularity) *
+                     left_box.area() +
+                 padded_count(right_cnt, options.leaf_granularity) *
+                     right_box.area();
     return cost > 0 ? cost : 1e30f;
   }
 
-  triangle_list& triangles;
+  float leaf_cost(const bvh_node& node) const {
+    return node.bounds.area() *
+           padded_count(node.tri_count, options.leaf_granularity);
+  }
+
+  const build_input& input;
+  std::vector<bvh_node>& nodes;
+  std::vector<index_t>& indices;
+  build_options options;
+
+  std::atomic<index_t> not_used = 2;
+};
+
+struct binned_sah {
+  static constexpr std::string_view name = "binned_sah";
+  static constexpr int bin_count = 8;
+
+  binned_sah(const build_input& input, std::vector<bvh_node>& nodes,
+             std::vector<index_t>& indices, const build_options& options)
+      : input(input), nodes(nodes), indices(indices), options(options) {}
+
+  void split(index_t node_idx) {
+    auto& node = nodes[node_idx];
+    // large nodes near the top of the tree also run their passes in parallel
+    bool wide = options.parallel && node.tri_count >= parallel_grain;
+    aabb centroid_bounds = update_bounds(node_idx, wide);
+
+    // compute split axis and bin
+    const auto [plane, split_bin, best_cost] =
+        split_point(node_idx, centroid_bounds, wide);
+
+    if (best_cost >= leaf_cost(node)) return;
+
+    // split triangles into two halves, using the same binning as the sweep
+    index_t left = node.first_tri_idx;
+    if (wide) {
+      auto first = indices.begin() + node.first_tri_idx;
+      auto in_left = [&](index_t i) {
+        return plane.bin(input.centroids[i]) <= split_bin;
+      };
+      auto middle = std::partition(std::execution::par, first,
+                                   first + node.tri_count, in_left);
+      left += static_cast<index_t>(middle - first);
+    } else {
+      index_t right = left + node.tri_count - 1;
+      while (left <= right) {
+        if (plane.bin(input.centroids[indices[left]]) <= split_bin) {
+          ++left;
+        } else {
+          std::swap(indices[left], indices[right--]);
+        }
+      }
+    }
+
+    // create child nodes for each half
+    index_t left_count = left - node.first_tri_idx;
+    if (left_count == 0 || left_count == node.tri_count) return;
+
+    index_t tri_count = node.tri_count;
+    index_t left_node_idx = not_used.fetch_add(2);
+    index_t right_node_idx = left_node_idx + 1;
+    nodes[left_node_idx].first_tri_idx = node.first_tri_idx;
+    nodes[left_node_idx].tri_count = left_count;
+    nodes[right_node_idx].first_tri_idx = left;
+    nodes[right_node_idx].tri_count = tri_count - left_count;
+
+    node.left_node = left_node_idx;
+    node.tri_count = 0;
+
+    if (options.parallel && tri_count >= parallel_grain) {
+      parallel_invoke([=, this] { split(left_node_idx); },
+                      [=, this] { split(right_node_idx); });
+    } else {
+      split(left_node_idx);
+      split(right_node_idx);
+    }
+  }
+
+  // triangle bounds and centroid bounds of a range of indices
+  using bounds_pair = std::pair<aabb, aabb>;
+
+  bounds_pair grow_bounds(index_t first, index_t last, bounds_pair b) const {
+    for (index_t i = first; i < last; ++i) {
+      b.first.grow(input.bounds[indices[i]]);
+      b.second.grow(input.centroids[indices[i]]);
+    }
+    return b;
+  }
+
+  // updates the node bounds and returns the bounds of its centroids
+  aabb update_bounds(index_t node_idx, bool wide) {
+    bvh_node& node = nodes[node_idx];
+    index_t end = node.first_tri_idx + node.tri_count;
+    bounds_pair b;
+    if (wide) {
+      b = parallel_reduce(
+          node.first_tri_idx, end, b,
+          [this](index_t first, index_t last, bounds_pair b) {
+            return grow_bounds(first, last, b);
+          },
+          [](bounds_pair a, const bounds_pair& b) {
+            a.first.grow(b.first);
+            a.second.grow(b.second);
+            return a;
+          });
+    } else {
+      b = grow_bounds(node.first_tri_idx, end, b);
+    }
+    node.bounds = b.first;
+    return b.second;
+  }
+
+  // maps a centroid to one of the bin_count slabs along an axis
+  struct binning {
+    int bin(const float3& centroid) const {
+      int b = static_cast<int>((centroid[axis] - min) * scale);
+      return std::clamp(b, 0, bin_count - 1);
+    }
+
+    int axis = -1;
+    float min = 0.0f;
+    float scale = 0.0f;
+  };
+
+  struct bin {
+    aabb bounds;
+    index_t tri_count = 0;
+  };
+  using bin_grid = std::array<std::array<bin, bin_count>, 3>;
+
+  bin_grid fill_bins(index_t first, index_t last,
+                     const std::array<binning, 3>& binnings,
+                     bin_grid bins) const {
+    for (index_t i = first; i < last; ++i) {
+      index_t tri = indices[i];
+      for (int axis = 0; axis < 3; ++axis) {
+        auto& b = bins[axis][binnings[axis].bin(input.centroids[tri])];
+        ++b.tri_count;
+        b.bounds.grow(input.bounds[tri]);
+      }
+    }
+    return bins;
+  }
+
+  // one pass over the triangles fills the bins of all three axes, then a
+  // prefix/suffix sweep over the bins evaluates every split plane.
+  std::tuple<binning, int, float> split_point(index_t node_idx,
+                                              const aabb& centroid_bounds,
+                                              bool wide) const {
+    const bvh_node& node = nodes[node_idx];
+    index_t end = node.first_tri_idx + node.tri_count;
+
+    std::array<binning, 3> binnings{};
+    for (int axis = 0; axis < 3; ++axis) {
+      float extent = centroid_bounds.max[axis] - centroid_bounds.min[axis];
+      binnings[axis].axis = axis;
+      binnings[axis].min = centroid_bounds.min[axis];
+      binnings[axis].scale = extent > 0 ? bin_count / extent : 0.0f;
+    }
+
+    bin_grid bins{};
+    if (wide) {
+      bins = parallel_reduce(
+          node.first_tri_idx, end, bins,
+          [&](index_t first, index_t last, bin_grid bins) {
+            return fill_bins(first, last, binnings, bins);
+          },
+          [](bin_grid a, const bin_grid& b) {
+            for (int axis = 0; axis < 3; ++axis) {
+              for (int i = 0; i < bin_count; ++i) {
+                a[axis][i].bounds.grow(b[axis][i].bounds);
+                a[axis][i].tri_count += b[axis][i].tri_count;
+              }
+            }
+            return a;
+          });
+    } else {
+      bins = fill_bins(node.first_tri_idx, end, binnings, bins);
+    }
+
+    binning best_binning;
+    int best_bin = -1;
+    float best_cost = max_v<float>;
+    for (int axis = 0; axis < 3; ++axis) {
+      if (binnings[axis].scale == 0.0f) continue;
+
+      // left[i] / right[i] describe the halves of the plane after bin i
+      std::array<float, bin_count - 1> left_area{}, right_area{};
+      std::array<index_t, bin_count - 1> left_count{}, right_count{};
+      aabb left_box, right_box;
+      index_t left_sum = 0, right_sum = 0;
+      for (int i = 0; i < bin_count - 1; ++i) {
+        const auto& l = bins[axis][i];
+        left_sum += l.tri_count;
+        left_box.grow(l.bounds);
+        left_count[i] = left_sum;
+        left_area[i] = left_box.area();
+
+        const auto& r = bins[axis][bin_count - 1 - i];
+        right_sum += r.tri_count;
+        right_box.grow(r.bounds);
+        right_count[bin_count - 2 - i] = right_sum;
+        right_area[bin_count - 2 - i] = right_box.area();
+      }
+
+      for (int i = 0; i < bin_count - 1; ++i) {
+        if (left_count[i] == 0 || right_count[i] == 0) continue;
+        index_t g = options.leaf_granularity;
+        float cost = padded_count(left_count[i], g) * left_area[i] +
+                     padded_count(right_count[i], g) * right_area[i];
+        if (cost < best_cost) {
+          best_binning = binnings[axis];
+          best_bin = i;
+          best_cost = cost;
+        }
+      }
+    }
+
+    return std::make_tuple(best_binning, best_bin, best_cost);
+  }
+
+  float leaf_cost(const bvh_node& node) const {
+    return node.bounds.area() *
+           padded_count(node.tri_count, options.leaf_granularity);
+  }
+
+  const build_input& input;
   std::vector<bvh_node>& nodes;
   std::vector<index_t>& indices;
+  build_options options;
 
-  index_t not_used = 2;
+  std::atomic<index_t> not_used = 2;
 };
\ No newline at end of file
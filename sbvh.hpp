@@ -0,0 +1,365 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <string_view>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "base.hpp"
+#include "parallel.hpp"
+
+// split bvh (Stich et al. 2009): next to binned object splits on reference
+// centroids it evaluates spatial splits, which clip the triangles that
+// straddle the plane into both children. A triangle can therefore appear in
+// several leaves, the total number of references is capped at
+// (1 + duplication_budget) * triangle count.
+struct sbvh {
+  static constexpr std::string_view name = "sbvh";
+  static constexpr int bin_count = 16;
+  // spatial splits are only tried when the children of the best object
+  // split overlap by more than alpha times the root surface area
+  static constexpr float alpha = 1e-5f;
+  static constexpr float duplication_budget = 0.3f;
+  // keeps the deepest path within the traversal stack of bvh::intersect
+  static constexpr int max_depth = 48;
+
+  sbvh(const build_input& input, std::vector<bvh_node>& nodes,
+       std::vector<index_t>& indices, const build_options& options)
+      : input(input), nodes(nodes), indices(indices), options(options) {}
+
+  // builds the whole hierarchy below the root at once
+  void split(index_t node_idx) {
+    const auto& root = nodes[node_idx];
+    std::vector<reference> refs(root.tri_count);
+    aabb root_bounds;
+    for (index_t i = 0; i < root.tri_count; ++i) {
+      auto& ref = refs[i];
+      ref.tri = indices[root.first_tri_idx + i];
+      ref.bounds = input.bounds[ref.tri];
+      root_bounds.grow(ref.bounds);
+    }
+    root_area = root_bounds.area();
+
+    // every reference can end up in its own leaf, size for the worst case
+    max_refs = root.first_tri_idx +
+               static_cast<index_t>(root.tri_count * (1 + duplication_budget));
+    ref_count = root.first_tri_idx + root.tri_count;
+    leaf_cursor = root.first_tri_idx;
+    indices.resize(max_refs);
+    nodes.resize(std::max<size_t>(nodes.size(), 2 * max_refs));
+
+    build(node_idx, std::move(refs), 0);
+    indices.resize(leaf_cursor);
+  }
+
+ private:
+  struct reference {
+    aabb bounds;
+    index_t tri;
+  };
+
+  struct bin {
+    aabb bounds;
+    index_t count = 0;
+  };
+
+  struct spatial_bin {
+    aabb bounds;
+    index_t entries = 0;
+    index_t exits = 0;
+  };
+
+  struct split_plan {
+    float cost = max_v<float>;
+    int axis = -1;
+    bool spatial = false;
+    // object split: references in bins [0, bin] go left
+    int bin = -1;
+    float min = 0.0f, scale = 0.0f;
+    // spatial split: plane position
+    float pos = 0.0f;
+    // bounds of the two halves, used for the overlap test
+    aabb left, right;
+  };
+
+  index_t padded(index_t count) const {
+    return padded_count(count, options.leaf_granularity);
+  }
+
+  static bool is_empty(const aabb& b) {
+    return b.min.x > b.max.x || b.min.y > b.max.y || b.min.z > b.max.z;
+  }
+
+  static aabb intersection(const aabb& a, const aabb& b) {
+    aabb r;
+    r.min = max(a.min, b.min);
+    r.max = min(a.max, b.max);
+    return r;
+  }
+
+  // bounds of the part of tri between lo and hi along axis, limited to the
+  // bounds of the reference it is split from
+  aabb clip(const reference& ref, int axis, float lo, float hi) const {
+    const triangle tri = input.mesh[ref.tri];
+    const std::array<float3, 3> v{tri.vertex0, tri.vertex1, tri.vertex2};
+    aabb box;
+    for (int i = 0; i < 3; ++i) {
+      const float3& a = v[i];
+      const float3& b = v[(i + 1) % 3];
+      float pa = a[axis], pb = b[axis];
+      if (pa >= lo && pa <= hi) box.grow(a);
+      // edge crossings of both planes
+      for (float plane : {lo, hi}) {
+        if ((pa < plane && pb > plane) || (pa > plane && pb < plane)) {
+          float t = (plane - pa) / (pb - pa);
+          float3 p = a + (b - a) * t;
+          p[axis] = plane;
+          box.grow(p);
+        }
+      }
+    }
+    return intersection(box, ref.bounds);
+  }
+
+  void build(index_t node_idx, std::vector<reference> refs, int depth) {
+    auto& node = nodes[node_idx];
+    node.bounds = aabb{};
+    aabb centroid_bounds;
+    for (const auto& ref : refs) {
+      node.bounds.grow(ref.bounds);
+      centroid_bounds.grow(ref.bounds.center());
+    }
+    index_t count = refs.size();
+
+    split_plan plan;
+    if (count > 1 && depth < max_depth) {
+      plan = object_split(refs, centroid_bounds);
+      aabb overlap = intersection(plan.left, plan.right);
+      bool overlapping = plan.axis < 0 || (!is_empty(overlap) &&
+                                           overlap.area() > alpha * root_area);
+      if (overlapping && ref_count < max_refs) {
+        split_plan spatial = spatial_split(refs, node.bounds);
+        if (spatial.cost < plan.cost) plan = spatial;
+      }
+    }
+
+    std::vector<reference> left, right;
+    if (plan.axis >= 0 &&
+        plan.cost < node.bounds.area() * padded(count)) {
+      if (plan.spatial) {
+        std::tie(left, right) = partition_spatial(refs, plan);
+      } else {
+        std::tie(left, right) = partition_object(refs, plan);
+      }
+    }
+
+    if (left.empty() || right.empty()) {
+      index_t first = leaf_cursor.fetch_add(count);
+      for (index_t i = 0; i < count; ++i) indices[first + i] = refs[i].tri;
+      node.first_tri_idx = first;
+      node.tri_count = count;
+      return;
+    }
+    refs = {};
+
+    index_t left_node_idx = not_used.fetch_add(2);
+    index_t right_node_idx = left_node_idx + 1;
+    node.left_node = left_node_idx;
+    node.tri_count = 0;
+
+    if (options.parallel && count >= parallel_grain) {
+      parallel_invoke(
+          [&, this] { build(left_node_idx, std::move(left), depth + 1); },
+          [&, this] { build(right_node_idx, std::move(right), depth + 1); });
+    } else {
+      build(left_node_idx, std::move(left), depth + 1);
+      build(right_node_idx, std::move(right), depth + 1);
+    }
+  }
+
+  split_plan object_split(const std::vector<reference>& refs,
+                          const aabb& centroid_bounds) const {
+    split_plan best;
+    for (int axis = 0; axis < 3; ++axis) {
+      float extent = centroid_bounds.max[axis] - centroid_bounds.min[axis];
+      if (extent <= 0) continue;
+      float min = centroid_bounds.min[axis];
+      float scale = bin_count / extent;
+      auto bin_of = [=](const reference& ref) {
+        int b = static_cast<int>((ref.bounds.center(axis) - min) * scale);
+        return std::clamp(b, 0, bin_count - 1);
+      };
+
+      std::array<bin, bin_count> bins{};
+      for (const auto& ref : refs) {
+        auto& b = bins[bin_of(ref)];
+        ++b.count;
+        b.bounds.grow(ref.bounds);
+      }
+
+      // right[i] holds the bounds and count of bins (i, bin_count)
+      std::array<bin, bin_count> right{};
+      for (int i = bin_count - 2; i >= 0; --i) {
+        right[i] = right[i + 1];
+        right[i].count += bins[i + 1].count;
+        right[i].bounds.grow(bins[i + 1].bounds);
+      }
+
+      bin left;
+      for (int i = 0; i < bin_count - 1; ++i) {
+        left.count += bins[i].count;
+        left.bounds.grow(bins[i].bounds);
+        if (left.count == 0 || right[i].count == 0) continue;
+        float cost = padded(left.count) * left.bounds.area() +
+                     padded(right[i].count) * right[i].bounds.area();
+        if (cost < best.cost) {
+          best.cost = cost;
+          best.axis = axis;
+          best.spatial = false;
+          best.bin = i;
+          best.min = min;
+          best.scale = scale;
+          best.left = left.bounds;
+          best.right = right[i].bounds;
+        }
+      }
+    }
+    return best;
+  }
+
+  split_plan spatial_split(const std::vector<reference>& refs,
+                           const aabb& bounds) const {
+    split_plan best;
+    for (int axis = 0; axis < 3; ++axis) {
+      float min = bounds.min[axis];
+      float extent = bounds.max[axis] - min;
+      if (extent <= 0) continue;
+      float width = extent / bin_count;
+      auto bin_of = [=](float p) {
+        int b = static_cast<int>((p - min) / width);
+        return std::clamp(b, 0, bin_count - 1);
+      };
+      // planes[b] lies between bins b and b + 1, best.pos is taken from it
+      std::array<float, bin_count - 1> planes;
+      for (int b = 0; b < bin_count - 1; ++b) planes[b] = min + (b + 1) * width;
+
+      std::array<spatial_bin, bin_count> bins{};
+      for (const auto& ref : refs) {
+        // the bins of the ends by the rule of partition_spatial: a reference
+        // is right of a plane if it ends after it, and left of it unless it
+        // also starts on or after it. bin_of only guesses, rounding and ends
+        // on a plane are settled against the planes themselves.
+        float lo = ref.bounds.min[axis], hi = ref.bounds.max[axis];
+        int last = bin_of(hi);
+        while (last > 0 && hi <= planes[last - 1]) --last;
+        while (last < bin_count - 1 && hi > planes[last]) ++last;
+        int first = std::min(bin_of(lo), last);
+        while (first > 0 && lo < planes[first - 1]) --first;
+        while (first < last && lo >= planes[first]) ++first;
+        ++bins[first].entries;
+        ++bins[last].exits;
+        if (first == last) {
+          bins[first].bounds.grow(ref.bounds);
+          continue;
+        }
+        for (int b = first; b <= last; ++b) {
+          aabb part = clip(ref, axis, min + b * width, min + (b + 1) * width);
+          if (!is_empty(part)) bins[b].bounds.grow(part);
+        }
+      }
+
+      // right[i] holds the bounds and exit count of bins (i, bin_count)
+      std::array<spatial_bin, bin_count> right{};
+      for (int i = bin_count - 2; i >= 0; --i) {
+        right[i] = right[i + 1];
+        right[i].exits += bins[i + 1].exits;
+        right[i].bounds.grow(bins[i + 1].bounds);
+      }
+
+      spatial_bin left;
+      for (int i = 0; i < bin_count - 1; ++i) {
+        left.entries += bins[i].entries;
+        left.bounds.grow(bins[i].bounds);
+        if (left.entries == 0 || right[i].exits == 0) continue;
+        float cost = padded(left.entries) * left.bounds.area() +
+                     padded(right[i].exits) * right[i].bounds.area();
+        if (cost < best.cost) {
+          best.cost = cost;
+          best.axis = axis;
+          best.spatial = true;
+          best.pos = planes[i];
+          best.left = left.bounds;
+          best.right = right[i].bounds;
+        }
+      }
+    }
+    return best;
+  }
+
+  std::pair<std::vector<reference>, std::vector<reference>> partition_object(
+      const std::vector<reference>& refs, const split_plan& plan) const {
+    std::vector<reference> left, right;
+    for (const auto& ref : refs) {
+      int b = static_cast<int>((ref.bounds.center(plan.axis) - plan.min) *
+                               plan.scale);
+      if (std::clamp(b, 0, bin_count - 1) <= plan.bin) {
+        left.push_back(ref);
+      } else {
+        right.push_back(ref);
+      }
+    }
+    return {std::move(left), std::move(right)};
+  }
+
+  std::pair<std::vector<reference>, std::vector<reference>> partition_spatial(
+      const std::vector<reference>& refs, const split_plan& plan) {
+    int axis = plan.axis;
+    index_t straddling = 0;
+    for (const auto& ref : refs) {
+      if (ref.bounds.min[axis] < plan.pos && ref.bounds.max[axis] > plan.pos) {
+        ++straddling;
+      }
+    }
+
+    // out of budget, fall back to the best object split
+    if (ref_count.fetch_add(straddling) + straddling > max_refs) {
+      ref_count.fetch_sub(straddling);
+      aabb centroid_bounds;
+      for (const auto& ref : refs) centroid_bounds.grow(ref.bounds.center());
+      split_plan object = object_split(refs, centroid_bounds);
+      if (object.axis < 0) return {};
+      return partition_object(refs, object);
+    }
+
+    std::vector<reference> left, right;
+    for (const auto& ref : refs) {
+      if (ref.bounds.max[axis] <= plan.pos) {
+        left.push_back(ref);
+      } else if (ref.bounds.min[axis] >= plan.pos) {
+        right.push_back(ref);
+      } else {
+        reference l{clip(ref, axis, min_v<float>, plan.pos), ref.tri};
+        reference r{clip(ref, axis, plan.pos, max_v<float>), ref.tri};
+        if (!is_empty(l.bounds)) left.push_back(l);
+        if (!is_empty(r.bounds)) right.push_back(r);
+        // clipping lost the triangle to rounding, keep it unsplit
+        if (is_empty(l.bounds) && is_empty(r.bounds)) left.push_back(ref);
+      }
+    }
+    return {std::move(left), std::move(right)};
+  }
+
+  const build_input& input;
+  std::vector<bvh_node>& nodes;
+  std::vector<index_t>& indices;
+  build_options options;
+
+  float root_area = 0.0f;
+  index_t max_refs = 0;
+  std::atomic<index_t> ref_count = 0;
+  std::atomic<index_t> leaf_cursor = 0;
+  std::atomic<index_t> not_used = 2;
+};
\ No newline at end of file
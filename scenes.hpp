@@ -0,0 +1,168 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <execution>
+#include <numeric>
+#include <print>
+#include <string_view>
+#include <vector>
+
+#include "basic.hpp"
+#include "bvh.hpp"
+#include "model.hpp"
+#include "quality.hpp"
+#include "sah.hpp"
+#include "surface.h"
+
+// the scenes of bvh and bvh_headless. They only draw into a Surface, the
+// caller decides whether it ends up in a window or in an image file.
+
+enum class shading {
+  depth,    // grey by hit distance
+  heatmap,  // color by traversal cost, needs BVH_STATS
+};
+
+inline shading parse_shading(std::string_view name) {
+  return name == "heatmap" ? shading::heatmap : shading::depth;
+}
+
+// blue for 0 over cyan, green and yellow to red for 1
+inline uint32_t heat_color(float t) {
+  t = std::clamp(t, 0.0f, 1.0f) * 4;
+  float r = std::clamp(t - 2, 0.0f, 1.0f);
+  float g = std::clamp(t, 0.0f, 1.0f) - std::clamp(t - 3, 0.0f, 1.0f);
+  float b = 1 - std::clamp(t - 1, 0.0f, 1.0f);
+  return (uint32_t(r * 255) << 16) | (uint32_t(g * 255) << 8) |
+         uint32_t(b * 255);
+}
+
+// nodes plus triangles visited that are shown red, a fixed scale keeps
+// heatmaps of different strategies comparable
+constexpr float heatmap_scale = 100;
+
+struct random_scene {
+  static constexpr const char* name = "basic bvh";
+  static constexpr int width = 1024, height = 512;
+
+  random_scene() : triangles(make_triangles(64)), tree(triangles) {}
+  random_scene(const random_scene&) = delete;
+  random_scene& operator=(const random_scene&) = delete;
+
+  void render(Surface& canvas) const {
+    timer timer;
+    float3 cam_pos{0, 0, -18};
+    float3 p0{-1, 1, -15}, p1{1, 1, -15}, p2{-1, -1, -15};
+    for (int y = 0; y < canvas.height; ++y) {
+      for (int x = 0; x < canvas.width; ++x) {
+        float u = x / float(canvas.width);
+        float v = y / float(canvas.height);
+        float3 pixel_pos = p0 + (p1 - p0) * u + (p2 - p0) * v;
+        ray r = ray{cam_pos, normalize(pixel_pos - cam_pos)};
+        // tree.intersect(r);
+        for (index_t i = 0; i < triangles.size(); ++i) {
+          intersect_tri(triangles[i], r, i);
+        }
+        if (r.t < 1e30f) canvas.Plot(x, y, 0x0000ff);
+      }
+    }
+
+    std::println("tracing time: {}ms ({}K rays/s)", timer.elapsed(),
+                 float(canvas.width * canvas.height) / timer.elapsed());
+  }
+
+  triangle_list triangles;
+  bvh<middle_point> tree;
+};
+
+struct unity_scene {
+  static constexpr const char* name = "binned sah bvh";
+  static constexpr int width = 640, height = 640;
+
+  explicit unity_scene(shading mode)
+      : triangles(unity_model()),
+        tree(triangles, {.parallel = true}, "unity.bvh"),
+        mode(mode) {
+    std::println("{}", analyze(tree.get_nodes()).print());
+#ifndef BVH_STATS
+    if (mode == shading::heatmap) {
+      std::println("the heatmap needs BVH_STATS, showing depth instead");
+      this->mode = shading::depth;
+    }
+#endif
+  }
+  unity_scene(const unity_scene&) = delete;
+  unity_scene& operator=(const unity_scene&) = delete;
+
+  void render(Surface& canvas) const {
+    timer timer;
+
+    canvas.Clear(0);
+    float3 cam_pos(-1.5f, -0.2f, -2.5f);
+    float3 p0(-2.5f, 0.8f, -0.5f);
+    float3 p1(-0.5f, 0.8f, -0.5f);
+    float3 p2(-2.5f, -1.2f, -0.5f);
+    auto camera_ray = [&](int x, int y) {
+      float u = x / float(canvas.width);
+      float v = y / float(canvas.height);
+      float3 pixel_pos = p0 + (p1 - p0) * u + (p2 - p0) * v;
+      return ray{cam_pos, normalize(pixel_pos - cam_pos)};
+    };
+
+    // the pinhole grid is traced in 4x4 tiles, one ray packet per tile. The
+    // heatmap traces single rays, packets only count for all their rays.
+    // Tiles on the right and bottom edge may stick out of the canvas.
+    constexpr int tile = 4;
+    int tiles_x = (canvas.width + tile - 1) / tile;
+    int len = tiles_x * ((canvas.height + tile - 1) / tile);
+    auto inside = [&](int x, int y) {
+      return x < canvas.width && y < canvas.height;
+    };
+    std::vector<int> indices(len);
+    std::iota(indices.begin(), indices.end(), 0);
+    std::for_each_n(std::execution::par, indices.begin(), len, [&](int& i) {
+      int x0 = i % tiles_x * tile;
+      int y0 = i / tiles_x * tile;
+#ifdef BVH_STATS
+      if (mode == shading::heatmap) {
+        for (int j = 0; j < tile * tile; ++j) {
+          int x = x0 + j % tile, y = y0 + j / tile;
+          if (!inside(x, y)) continue;
+          ray r = camera_ray(x, y);
+          tree.intersect(r);
+          frame_stats::record(r.stats);
+          float cost = r.stats.inner_nodes + r.stats.triangle_tests;
+          canvas.Plot(x, y, heat_color(cost / heatmap_scale));
+        }
+        return;
+      }
+#endif
+      // lanes outside the canvas are filled but left out of the active mask
+      ray_packet<tile * tile> packet;
+      for (int j = 0; j < tile * tile; ++j) {
+        int x = x0 + j % tile, y = y0 + j / tile;
+        packet.set(j, camera_ray(x, y));
+        if (!inside(x, y)) packet.active &= ~(1u << j);
+      }
+      tree.intersect(packet);
+      // packet counters are shared by its rays, the averages are per ray
+      BVH_STAT(frame_stats::record(packet.stats,
+                                   std::popcount(packet.active)));
+      for (int j = 0; j < tile * tile; ++j) {
+        int x = x0 + j % tile, y = y0 + j / tile;
+        float t = packet.t[j];
+        uint32_t c = 500 - (int)(t * 20);
+        if (inside(x, y) && t < 1e30f) canvas.Plot(x, y, c * 0x10101);
+      }
+    });
+
+    std::println("tracing time: {}ms ({}M rays/s)", timer.elapsed(),
+                 float(canvas.width * canvas.height) / timer.elapsed() / 1000);
+    BVH_STAT(std::println("{}", frame_stats::take().print()));
+  }
+
+  triangle_list triangles;
+  bvh<binned_sah> tree;
+  shading mode;
+};
\ No newline at end of file
@@ -0,0 +1,273 @@
+#pragma once
+
+#include <array>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define BVH_SIMD_SSE 1
+#include <immintrin.h>
+#endif
+#if defined(__AVX__)
+#define BVH_SIMD_AVX 1
+#endif
+
+// minimal N lane float vectors. The generic version is a plain array the
+// compiler is free to vectorize, 4 lanes map to SSE and 8 lanes to AVX.
+
+template <int N>
+struct vbool {
+  int mask() const {
+    int m = 0;
+    for (int i = 0; i < N; ++i) m |= static_cast<int>(lanes[i]) << i;
+    return m;
+  }
+
+  friend vbool operator&(const vbool& a, const vbool& b) {
+    vbool r;
+    for (int i = 0; i < N; ++i) r.lanes[i] = a.lanes[i] && b.lanes[i];
+    return r;
+  }
+  friend vbool operator|(const vbool& a, const vbool& b) {
+    vbool r;
+    for (int i = 0; i < N; ++i) r.lanes[i] = a.lanes[i] || b.lanes[i];
+    return r;
+  }
+
+  std::array<bool, N> lanes{};
+};
+
+template <int N>
+struct vfloat {
+  vfloat() = default;
+  vfloat(float f) { lanes.fill(f); }
+
+  static vfloat load(const float* p) {
+    vfloat r;
+    for (int i = 0; i < N; ++i) r.lanes[i] = p[i];
+    return r;
+  }
+  void store(float* p) const {
+    for (int i = 0; i < N; ++i) p[i] = lanes[i];
+  }
+
+  float operator[](int i) const { return lanes[i]; }
+
+  template <typename Op>
+  friend vfloat apply(const vfloat& a, const vfloat& b, Op op) {
+    vfloat r;
+    for (int i = 0; i < N; ++i) r.lanes[i] = op(a.lanes[i], b.lanes[i]);
+    return r;
+  }
+  template <typename Op>
+  friend vbool<N> compare(const vfloat& a, const vfloat& b, Op op) {
+    vbool<N> r;
+    for (int i = 0; i < N; ++i) r.lanes[i] = op(a.lanes[i], b.lanes[i]);
+    return r;
+  }
+
+  friend vfloat operator+(const vfloat& a, const vfloat& b) {
+    return apply(a, b, [](float x, float y) { return x + y; });
+  }
+  friend vfloat operator-(const vfloat& a, const vfloat& b) {
+    return apply(a, b, [](float x, float y) { return x - y; });
+  }
+  friend vfloat operator*(const vfloat& a, const vfloat& b) {
+    return apply(a, b, [](float x, float y) { return x * y; });
+  }
+  friend vfloat operator/(const vfloat& a, const vfloat& b) {
+    return apply(a, b, [](float x, float y) { return x / y; });
+  }
+  friend vfloat min(const vfloat& a, const vfloat& b) {
+    return apply(a, b, [](float x, float y) { return x < y ? x : y; });
+  }
+  friend vfloat max(const vfloat& a, const vfloat& b) {
+    return apply(a, b, [](float x, float y) { return x > y ? x : y; });
+  }
+  friend vfloat abs(const vfloat& a) {
+    return apply(a, a, [](float x, float) { return std::abs(x); });
+  }
+
+  friend vbool<N> operator<(const vfloat& a, const vfloat& b) {
+    return compare(a, b, [](float x, float y) { return x < y; });
+  }
+  friend vbool<N> operator<=(const vfloat& a, const vfloat& b) {
+    return compare(a, b, [](float x, float y) { return x <= y; });
+  }
+  friend vbool<N> operator>(const vfloat& a, const vfloat& b) {
+    return compare(a, b, [](float x, float y) { return x > y; });
+  }
+  friend vbool<N> operator>=(const vfloat& a, const vfloat& b) {
+    return compare(a, b, [](float x, float y) { return x >= y; });
+  }
+
+  friend vfloat select(const vbool<N>& m, const vfloat& a, const vfloat& b) {
+    vfloat r;
+    for (int i = 0; i < N; ++i) {
+      r.lanes[i] = m.lanes[i] ? a.lanes[i] : b.lanes[i];
+    }
+    return r;
+  }
+
+  std::array<float, N> lanes{};
+};
+
+#ifdef BVH_SIMD_SSE
+template <>
+struct vbool<4> {
+  int mask() const { return _mm_movemask_ps(v); }
+
+  friend vbool operator&(const vbool& a, const vbool& b) {
+    return {_mm_and_ps(a.v, b.v)};
+  }
+  friend vbool operator|(const vbool& a, const vbool& b) {
+    return {_mm_or_ps(a.v, b.v)};
+  }
+
+  __m128 v;
+};
+
+template <>
+struct vfloat<4> {
+  vfloat() = default;
+  vfloat(__m128 v) : v(v) {}
+  vfloat(float f) : v(_mm_set1_ps(f)) {}
+
+  static vfloat load(const float* p) { return _mm_loadu_ps(p); }
+  void store(float* p) const { _mm_storeu_ps(p, v); }
+
+  float operator[](int i) const {
+    alignas(16) float lanes[4];
+    _mm_store_ps(lanes, v);
+    return lanes[i];
+  }
+
+  friend vfloat operator+(vfloat a, vfloat b) { return _mm_add_ps(a.v, b.v); }
+  friend vfloat operator-(vfloat a, vfloat b) { return _mm_sub_ps(a.v, b.v); }
+  friend vfloat operator*(vfloat a, vfloat b) { return _mm_mul_ps(a.v, b.v); }
+  friend vfloat operator/(vfloat a, vfloat b) { return _mm_div_ps(a.v, b.v); }
+  friend vfloat min(vfloat a, vfloat b) { return _mm_min_ps(a.v, b.v); }
+  friend vfloat max(vfloat a, vfloat b) { return _mm_max_ps(a.v, b.v); }
+  friend vfloat abs(vfloat a) {
+    return _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v);
+  }
+
+  friend vbool<4> operator<(vfloat a, vfloat b) {
+    return {_mm_cmplt_ps(a.v, b.v)};
+  }
+  friend vbool<4> operator<=(vfloat a, vfloat b) {
+    return {_mm_cmple_ps(a.v, b.v)};
+  }
+  friend vbool<4> operator>(vfloat a, vfloat b) {
+    return {_mm_cmpgt_ps(a.v, b.v)};
+  }
+  friend vbool<4> operator>=(vfloat a, vfloat b) {
+    return {_mm_cmpge_ps(a.v, b.v)};
+  }
+
+  friend vfloat select(vbool<4> m, vfloat a, vfloat b) {
+    return _mm_or_ps(_mm_and_ps(m.v, a.v), _mm_andnot_ps(m.v, b.v));
+  }
+
+  __m128 v;
+};
+#endif
+
+#ifdef BVH_SIMD_AVX
+template <>
+struct vbool<8> {
+  int mask() const { return _mm256_movemask_ps(v); }
+
+  friend vbool operator&(const vbool& a, const vbool& b) {
+    return {_mm256_and_ps(a.v, b.v)};
+  }
+  friend vbool operator|(const vbool& a, const vbool& b) {
+    return {_mm256_or_ps(a.v, b.v)};
+  }
+
+  __m256 v;
+};
+
+template <>
+struct vfloat<8> {
+  vfloat() = default;
+  vfloat(__m256 v) : v(v) {}
+  vfloat(float f) : v(_mm256_set1_ps(f)) {}
+
+  static vfloat load(const float* p) { return _mm256_loadu_ps(p); }
+  void store(float* p) const { _mm256_storeu_ps(p, v); }
+
+  float operator[](int i) const {
+    alignas(32) float lanes[8];
+    _mm256_store_ps(lanes, v);
+    return lanes[i];
+  }
+
+  friend vfloat operator+(vfloat a, vfloat b) {
+    return _mm256_add_ps(a.v, b.v);
+  }
+  friend vfloat operator-(vfloat a, vfloat b) {
+    return _mm256_sub_ps(a.v, b.v);
+  }
+  friend vfloat operator*(vfloat a, vfloat b) {
+    return _mm256_mul_ps(a.v, b.v);
+  }
+  friend vfloat operator/(vfloat a, vfloat b) {
+    return _mm256_div_ps(a.v, b.v);
+  }
+  friend vfloat min(vfloat a, vfloat b) { return _mm256_min_ps(a.v, b.v); }
+  friend vfloat max(vfloat a, vfloat b) { return _mm256_max_ps(a.v, b.v); }
+  friend vfloat abs(vfloat a) {
+    return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v);
+  }
+
+  friend vbool<8> operator<(vfloat a, vfloat b) {
+    return {_mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ)};
+  }
+  friend vbool<8> operator<=(vfloat a, vfloat b) {
+    return {_mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ)};
+  }
+  friend vbool<8> operator>(vfloat a, vfloat b) {
+    return {_mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ)};
+  }
+  friend vbool<8> operator>=(vfloat a, vfloat b) {
+    return {_mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ)};
+  }
+
+  friend vfloat select(vbool<8> m, vfloat a, vfloat b) {
+    return _mm256_blendv_ps(b.v, a.v, m.v);
+  }
+
+  __m256 v;
+};
+#endif
+
+#ifdef BVH_SIMD_AVX
+constexpr int simd_width = 8;
+#else
+constexpr int simd_width = 4;
+#endif
+
+// N lanes of float3 in structure of arrays form
+template <int N>
+struct vfloat3 {
+  vfloat3() = default;
+  vfloat3(const vfloat<N>& x, const vfloat<N>& y, const vfloat<N>& z)
+      : x(x), y(y), z(z) {}
+  vfloat3(float x, float y, float z) : x(x), y(y), z(z) {}
+
+  friend vfloat3 operator+(const vfloat3& a, const vfloat3& b) {
+    return {a.x + b.x, a.y + b.y, a.z + b.z};
+  }
+  friend vfloat3 operator-(const vfloat3& a, const vfloat3& b) {
+    return {a.x - b.x, a.y - b.y, a.z - b.z};
+  }
+  friend vfloat<N> dot(const vfloat3& a, const vfloat3& b) {
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+  }
+  friend vfloat3 cross(const vfloat3& a, const vfloat3& b) {
+    return {a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z,
+            a.x * b.y - a.y * b.x};
+  }
+
+  vfloat<N> x, y, z;
+};
\ No newline at end of file
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <format>
+#include <mutex>
+#include <string>
+
+// traversal statistics, compiled in with BVH_STATS. Without it BVH_STAT
+// drops its statement and rays carry no counters.
+#ifdef BVH_STATS
+#define BVH_STAT(statement) statement
+#else
+#define BVH_STAT(statement)
+#endif
+
+// counters of one ray, the traversals add to them
+struct ray_stats {
+  uint32_t inner_nodes = 0;     // nodes whose children were tested
+  uint32_t leaves = 0;          // leaves whose triangles were tested
+  uint32_t aabb_tests = 0;      // ray box tests
+  uint32_t triangle_tests = 0;  // simd leaves count padding lanes too
+  uint32_t max_stack_depth = 0;
+
+  ray_stats& operator+=(const ray_stats& s) {
+    inner_nodes += s.inner_nodes;
+    leaves += s.leaves;
+    aabb_tests += s.aabb_tests;
+    triangle_tests += s.triangle_tests;
+    max_stack_depth = std::max(max_stack_depth, s.max_stack_depth);
+    return *this;
+  }
+};
+
+// sums of the counters of many rays
+struct traversal_stats {
+  void add(const ray_stats& s, uint64_t ray_count = 1) {
+    rays += ray_count;
+    inner_nodes += s.inner_nodes;
+    leaves += s.leaves;
+    aabb_tests += s.aabb_tests;
+    triangle_tests += s.triangle_tests;
+    max_stack_depth = std::max(max_stack_depth, s.max_stack_depth);
+  }
+
+  traversal_stats& operator+=(const traversal_stats& s) {
+    rays += s.rays;
+    inner_nodes += s.inner_nodes;
+    leaves += s.leaves;
+    aabb_tests += s.aabb_tests;
+    triangle_tests += s.triangle_tests;
+    max_stack_depth = std::max(max_stack_depth, s.max_stack_depth);
+    return *this;
+  }
+
+  // averages per ray
+  std::string print() const {
+    double n = std::max<uint64_t>(rays, 1);
+    return std::format(
+        "{} rays, per ray: {:.2f} inner nodes, {:.2f} leaves, {:.2f} aabb "
+        "tests, {:.2f} triangle tests, max stack depth {}",
+        rays, inner_nodes / n, leaves / n, aabb_tests / n, triangle_tests / n,
+        max_stack_depth);
+  }
+
+  uint64_t rays = 0;
+  uint64_t inner_nodes = 0;
+  uint64_t leaves = 0;
+  uint64_t aabb_tests = 0;
+  uint64_t triangle_tests = 0;
+  uint32_t max_stack_depth = 0;
+};
+
+// totals of the rays traced in the current frame. Every thread adds into a
+// slot of its own cache line, so tracing threads never share a counter.
+struct frame_stats {
+  // adds the counters of finished rays to the slot of the calling thread
+  static void record(const ray_stats& s, uint64_t ray_count = 1) {
+    local().add(s, ray_count);
+  }
+
+  // sums and clears the slots of all threads, call it between frames while
+  // no rays are traced
+  static traversal_stats take() {
+    std::lock_guard lock(mutex);
+    traversal_stats total;
+    for (auto& slot : slots) {
+      total += slot.stats;
+      slot.stats = {};
+    }
+    return total;
+  }
+
+ private:
+  struct alignas(64) slot {
+    traversal_stats stats;
+  };
+
+  static traversal_stats& local() {
+    // slots outlive their threads, a deque never moves its elements
+    thread_local traversal_stats* stats = [] {
+      std::lock_guard lock(mutex);
+      return &slots.emplace_back().stats;
+    }();
+    return *stats;
+  }
+
+  static inline std::mutex mutex;
+  static inline std::deque<slot> slots;
+};
\ No newline at end of file
@@ -0,0 +1,127 @@
+#include "surface.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+uint32_t crc32(const uint8_t* data, size_t size, uint32_t crc = 0) {
+  static const auto table = [] {
+    std::array<uint32_t, 256> t{};
+    for (uint32_t n = 0; n < 256; ++n) {
+      uint32_t c = n;
+      for (int k = 0; k < 8; ++k) c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+      t[n] = c;
+    }
+    return t;
+  }();
+  crc = ~crc;
+  for (size_t i = 0; i < size; ++i) {
+    crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+void put_u32(std::vector<uint8_t>& out, uint32_t v) {
+  out.push_back(v >> 24);
+  out.push_back(v >> 16);
+  out.push_back(v >> 8);
+  out.push_back(v);
+}
+
+void put_chunk(std::vector<uint8_t>& out, const char* type,
+               const std::vector<uint8_t>& data) {
+  put_u32(out, data.size());
+  size_t start = out.size();
+  out.insert(out.end(), type, type + 4);
+  out.insert(out.end(), data.begin(), data.end());
+  put_u32(out, crc32(out.data() + start, out.size() - start));
+}
+
+// rgb rows behind a filter byte, stored in uncompressed deflate blocks. The
+// images are small enough that compressing them is not worth a dependency.
+std::vector<uint8_t> encode_png(const Surface& s) {
+  std::vector<uint8_t> raw;
+  raw.reserve(s.height * (1 + s.width * 3));
+  for (int y = 0; y < s.height; ++y) {
+    raw.push_back(0);  // no filter
+    for (int x = 0; x < s.width; ++x) {
+      uint32_t c = s.pixels[y * s.width + x];
+      raw.push_back(c >> 16);
+      raw.push_back(c >> 8);
+      raw.push_back(c);
+    }
+  }
+
+  std::vector<uint8_t> zlib{0x78, 0x01};
+  constexpr size_t max_block = 65535;
+  size_t pos = 0;
+  do {
+    size_t len = std::min(max_block, raw.size() - pos);
+    zlib.push_back(pos + len == raw.size() ? 1 : 0);  // last block flag
+    zlib.push_back(len);
+    zlib.push_back(len >> 8);
+    zlib.push_back(~len);
+    zlib.push_back(~len >> 8);
+    zlib.insert(zlib.end(), raw.begin() + pos, raw.begin() + pos + len);
+    pos += len;
+  } while (pos < raw.size());
+  uint32_t a = 1, b = 0;
+  for (uint8_t byte : raw) {
+    a = (a + byte) % 65521;
+    b = (b + a) % 65521;
+  }
+  put_u32(zlib, (b << 16) | a);
+
+  std::vector<uint8_t> header;
+  put_u32(header, s.width);
+  put_u32(header, s.height);
+  header.insert(header.end(), {8, 2, 0, 0, 0});  // 8 bit rgb
+
+  std::vector<uint8_t> png{0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+  put_chunk(png, "IHDR", header);
+  put_chunk(png, "IDAT", zlib);
+  put_chunk(png, "IEND", {});
+  return png;
+}
+
+std::vector<uint8_t> encode_ppm(const Surface& s) {
+  std::string header =
+      "P6\n" + std::to_string(s.width) + " " + std::to_string(s.height) +
+      "\n255\n";
+  std::vector<uint8_t> ppm(header.begin(), header.end());
+  ppm.reserve(ppm.size() + s.pixels.size() * 3);
+  for (uint32_t c : s.pixels) {
+    ppm.push_back(c >> 16);
+    ppm.push_back(c >> 8);
+    ppm.push_back(c);
+  }
+  return ppm;
+}
+
+}  // namespace
+
+// 32-bit surface container
+
+Surface::Surface(int w, int h)
+    : width(w), height(h), pixels(width * height, 0) {}
+void Surface::Clear(uint32_t c) { std::fill(pixels.begin(), pixels.end(), c); }
+void Surface::Plot(int x, int y, uint32_t c) { pixels[y * width + x] = c; }
+
+void Surface::SaveImage(const char* file) const {
+  std::string_view name(file);
+  auto bytes = name.ends_with(".png") ? encode_png(*this) : encode_ppm(*this);
+  FILE* f = fopen(file, "wb");
+  if (f == nullptr) {
+    throw std::runtime_error(std::string("failed to create ") + file);
+  }
+  bool ok = fwrite(bytes.data(), 1, bytes.size(), f) == bytes.size();
+  ok = fclose(f) == 0 && ok;
+  if (!ok) throw std::runtime_error(std::string("failed to write ") + file);
+}
\ No newline at end of file
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// 32-bit surface container, pixels are 0xrrggbb. It needs no window or
+// OpenGL context, the viewer uploads it as a texture.
+class Surface {
+  enum { OWNER = 1 };
+
+ public:
+  Surface(int w, int h);
+  ~Surface() = default;
+
+  void Clear(uint32_t c);
+  void Plot(int x, int y, uint32_t c);
+
+  void InitCharset();
+  void SetChar(int c, const char* c1, const char* c2, const char* c3,
+               const char* c4, const char* c5);
+  void Print(const char* t, int x1, int y1, uint32_t c);
+  void Line(float x1, float y1, float x2, float y2, uint32_t c);
+  void LoadImage(const char* file);
+  // png if file ends with .png, binary ppm otherwise
+  void SaveImage(const char* file) const;
+  void CopyTo(Surface* dst, int x, int y);
+  void Box(int x1, int y1, int x2, int y2, uint32_t color);
+  void Bar(int x1, int y1, int x2, int y2, uint32_t color);
+
+  int width = 0, height = 0;
+  std::vector<uint32_t> pixels;  // rgba
+};
\ No newline at end of file
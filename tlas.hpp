@@ -0,0 +1,266 @@
+#pragma once
+
+#include <array>
+#include <optional>
+#include <vector>
+
+#include "base.hpp"
+#include "bvh.hpp"
+#include "sah.hpp"
+
+// affine transform, the upper 3x4 part of a row major 4x4 matrix
+struct transform {
+  static transform translation(const float3& t) {
+    transform r;
+    r.m[3] = t.x;
+    r.m[7] = t.y;
+    r.m[11] = t.z;
+    return r;
+  }
+  static transform scaling(const float3& s) {
+    transform r;
+    r.m[0] = s.x;
+    r.m[5] = s.y;
+    r.m[10] = s.z;
+    return r;
+  }
+  // counter clockwise around a unit axis
+  static transform rotation(const float3& axis, float radians) {
+    float c = std::cos(radians), s = std::sin(radians), k = 1 - c;
+    const float3& a = axis;
+    transform r;
+    r.m = {a.x * a.x * k + c,       a.x * a.y * k - a.z * s,
+           a.x * a.z * k + a.y * s, 0,
+           a.y * a.x * k + a.z * s, a.y * a.y * k + c,
+           a.y * a.z * k - a.x * s, 0,
+           a.z * a.x * k - a.y * s, a.z * a.y * k + a.x * s,
+           a.z * a.z * k + c,       0};
+    return r;
+  }
+
+  float3 point(const float3& p) const {
+    return {m[0] * p.x + m[1] * p.y + m[2] * p.z + m[3],
+            m[4] * p.x + m[5] * p.y + m[6] * p.z + m[7],
+            m[8] * p.x + m[9] * p.y + m[10] * p.z + m[11]};
+  }
+  float3 vector(const float3& v) const {
+    return {m[0] * v.x + m[1] * v.y + m[2] * v.z,
+            m[4] * v.x + m[5] * v.y + m[6] * v.z,
+            m[8] * v.x + m[9] * v.y + m[10] * v.z};
+  }
+
+  // inverse of the 3x3 part from its adjugate, then the translation
+  transform inverse() const {
+    float3 r0(m[0], m[1], m[2]), r1(m[4], m[5], m[6]), r2(m[8], m[9], m[10]);
+    float3 c0 = cross(r1, r2), c1 = cross(r2, r0), c2 = cross(r0, r1);
+    float inv_det = 1 / dot(r0, c0);
+    transform r;
+    r.m = {c0.x * inv_det, c1.x * inv_det, c2.x * inv_det, 0,
+           c0.y * inv_det, c1.y * inv_det, c2.y * inv_det, 0,
+           c0.z * inv_det, c1.z * inv_det, c2.z * inv_det, 0};
+    float3 t = -r.vector(float3(m[3], m[7], m[11]));
+    r.m[3] = t.x;
+    r.m[7] = t.y;
+    r.m[11] = t.z;
+    return r;
+  }
+
+  friend transform operator*(const transform& a, const transform& b) {
+    transform r;
+    for (int row = 0; row < 3; ++row) {
+      for (int col = 0; col < 4; ++col) {
+        float sum = col == 3 ? a.m[row * 4 + 3] : 0.0f;
+        for (int k = 0; k < 3; ++k) sum += a.m[row * 4 + k] * b.m[k * 4 + col];
+        r.m[row * 4 + col] = sum;
+      }
+    }
+    return r;
+  }
+
+  std::array<float, 12> m{1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0};
+};
+
+// a shared bottom level bvh placed in the world
+template <bvh_strategy Strategy>
+struct instance {
+  instance(const bvh<Strategy>& blas, const transform& to_world)
+      : blas(&blas), to_world(to_world), to_object(to_world.inverse()) {}
+
+  void set_transform(const transform& t) {
+    to_world = t;
+    to_object = t.inverse();
+  }
+
+  aabb bounds() const {
+    const aabb& local = blas->get_nodes()[0].bounds;
+    aabb world;
+    for (int i = 0; i < 8; ++i) {
+      world.grow(to_world.point({i & 1 ? local.max.x : local.min.x,
+                                 i & 2 ? local.max.y : local.min.y,
+                                 i & 4 ? local.max.z : local.min.z}));
+    }
+    return world;
+  }
+
+  const bvh<Strategy>* blas;
+  transform to_world, to_object;
+};
+
+// top level bvh over instances of bottom level bvhs. The top level reuses
+// the regular builders: every instance becomes a proxy triangle spanning its
+// world bounds, so TopStrategy must not clip triangles (sbvh).
+template <bvh_strategy Strategy, bvh_strategy TopStrategy = binned_sah>
+struct tlas {
+  explicit tlas(std::vector<instance<Strategy>> instances,
+                build_options options = {})
+      : instances(std::move(instances)), options(options) {
+    build();
+  }
+  tlas(const tlas&) = delete;
+  tlas& operator=(const tlas&) = delete;
+
+  // rebuilds the top level, cheap compared to the bottom levels. Call it
+  // after moving instances.
+  void build();
+
+  // rays are moved into object space at the instance boundary, the hit
+  // record gets the instance index next to the triangle of its blas
+  void intersect(ray& r) const;
+  bool occluded(const ray& r) const;
+
+  std::vector<instance<Strategy>>& get_instances() { return instances; }
+  const std::vector<instance<Strategy>>& get_instances() const {
+    return instances;
+  }
+
+ private:
+  static ray to_object(const instance<Strategy>& inst, const ray& r) {
+    ray local(inst.to_object.point(r.origin),
+              inst.to_object.vector(r.direction));
+    // the direction is not normalized again, so t is the same in both spaces
+    local.t = r.t;
+    return local;
+  }
+
+  std::vector<instance<Strategy>> instances;
+  build_options options;
+  triangle_list proxies;
+  std::optional<bvh<TopStrategy>> top;
+};
+
+template <bvh_strategy Strategy, bvh_strategy TopStrategy>
+void tlas<Strategy, TopStrategy>::build() {
+  TRACE;
+
+  proxies.resize(instances.size());
+  for (index_t i = 0; i < instances.size(); ++i) {
+    aabb bounds = instances[i].bounds();
+    proxies[i] = {bounds.min, bounds.max, bounds.max};
+  }
+
+  build_options top_options;
+  top_options.parallel = options.parallel;
+  top.reset();
+  if (!instances.empty()) top.emplace(proxies, top_options);
+}
+
+template <bvh_strategy Strategy, bvh_strategy TopStrategy>
+void tlas<Strategy, TopStrategy>::intersect(ray& r) const {
+  if (!top) return;
+  auto nodes = top->get_nodes();
+  auto indices = top->get_indices();
+  const bvh_node* node = &nodes[0];
+  std::array<const bvh_node*, 64> stack{};
+  index_t stack_idx = 0;
+
+  BVH_STAT(++r.stats.aabb_tests);
+  if (!node->bounds.intersect(r)) return;
+  while (true) {
+    if (node->is_leaf()) {
+      BVH_STAT(++r.stats.leaves);
+      for (index_t i = node->first_tri_idx;
+           i < (node->first_tri_idx + node->tri_count); ++i) {
+        const auto& inst = instances[indices[i]];
+        ray local = to_object(inst, r);
+        inst.blas->intersect(local);
+        // the blas counts into the object space copy
+        BVH_STAT(r.stats += local.stats);
+        if (local.t < r.t) {
+          r.t = local.t;
+          r.u = local.u;
+          r.v = local.v;
+          r.prim = local.prim;
+          r.instance = indices[i];
+        }
+      }
+      if (stack_idx == 0) break;
+      node = stack[--stack_idx];
+      continue;
+    }
+
+    BVH_STAT(++r.stats.inner_nodes);
+    BVH_STAT(r.stats.aabb_tests += 2);
+    const bvh_node* child1 = &nodes[node->left_node];
+    const bvh_node* child2 = &nodes[node->left_node + 1];
+    float dist1 = child1->bounds.intersect2(r);
+    float dist2 = child2->bounds.intersect2(r);
+    if (dist1 > dist2) {
+      std::swap(dist1, dist2);
+      std::swap(child1, child2);
+    }
+
+    if (dist1 == 1e30f) {
+      if (stack_idx == 0) break;
+      node = stack[--stack_idx];
+      continue;
+    }
+
+    node = child1;
+    if (dist2 < 1e30f) stack[stack_idx++] = child2;
+    BVH_STAT(r.stats.max_stack_depth =
+                 std::max(r.stats.max_stack_depth, stack_idx));
+  }
+}
+
+template <bvh_strategy Strategy, bvh_strategy TopStrategy>
+bool tlas<Strategy, TopStrategy>::occluded(const ray& r) const {
+  if (!top) return false;
+  auto nodes = top->get_nodes();
+  auto indices = top->get_indices();
+  const bvh_node* node = &nodes[0];
+  std::array<const bvh_node*, 64> stack{};
+  index_t stack_idx = 0;
+
+  BVH_STAT(++r.stats.aabb_tests);
+  if (!node->bounds.intersect(r)) return false;
+  while (true) {
+    if (node->is_leaf()) {
+      BVH_STAT(++r.stats.leaves);
+      for (index_t i = node->first_tri_idx;
+           i < (node->first_tri_idx + node->tri_count); ++i) {
+        const auto& inst = instances[indices[i]];
+        ray local = to_object(inst, r);
+        bool hit = inst.blas->occluded(local);
+        BVH_STAT(r.stats += local.stats);
+        if (hit) return true;
+      }
+    } else {
+      BVH_STAT(++r.stats.inner_nodes);
+      BVH_STAT(r.stats.aabb_tests += 2);
+      const bvh_node* child1 = &nodes[node->left_node];
+      const bvh_node* child2 = &nodes[node->left_node + 1];
+      bool hit1 = child1->bounds.intersect(r);
+      bool hit2 = child2->bounds.intersect(r);
+      if (hit1 && hit2) stack[stack_idx++] = child2;
+      BVH_STAT(r.stats.max_stack_depth =
+                   std::max(r.stats.max_stack_depth, stack_idx));
+      if (hit1 || hit2) {
+        node = hit1 ? child1 : child2;
+        continue;
+      }
+    }
+
+    if (stack_idx == 0) return false;
+    node = stack[--stack_idx];
+  }
+}
\ No newline at end of file
@@ -0,0 +1,24 @@
+#include <print>
+#include <string>
+
+#include "model.hpp"
+
+// converts a text .tri file into the binary format read by tri_file
+int main(int argc, char** argv) {
+  if (argc != 3) {
+    std::println("usage: tri_convert <input.tri> <output.trib>");
+    return 1;
+  }
+
+  try {
+    timer t;
+    auto triangles = text_model(argv[1]);
+    write_tri_file(argv[2], triangles);
+    std::println("wrote {} triangles to {} in {}ms", triangles.size(), argv[2],
+                 t.elapsed());
+  } catch (const std::exception& e) {
+    std::println("{}", e.what());
+    return 1;
+  }
+  return 0;
+}
\ No newline at end of file
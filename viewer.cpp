@@ -199,13 +199,6 @@ Shader::Shader(const char* const vertex_shader_source,
 
   glUseProgram(shader_program_);
 }
-// 32-bit surface container
-
-Surface::Surface(int w, int h)
-    : width(w), height(h), pixels(width * height, 0) {}
-void Surface::Clear(uint32_t c) { std::fill(pixels.begin(), pixels.end(), c); }
-void Surface::Plot(int x, int y, uint32_t c) { pixels[y * width + x] = c; }
-
 // class Texture {};
 
 Texture::Texture(int w, int h, int slot) : width_(w), height_(h), slot_(slot) {
@@ -7,6 +7,7 @@
 
 #include "GLFW/glfw3.h"
 #include "glad/glad.h"
+#include "surface.h"
 
 struct Window {
   explicit Window(const char* name, int width = 800, int height = 600);
@@ -101,31 +102,6 @@ void inline Shader::set_uniform(const char* name, const float& value) const {
   glUniform1f(glGetUniformLocation(shader_program_, name), value);
 }
 
-// 32-bit surface container
-class Surface {
-  enum { OWNER = 1 };
-
- public:
-  Surface(int w, int h);
-  ~Surface() = default;
-
-  void Clear(uint32_t c);
-  void Plot(int x, int y, uint32_t c);
-
-  void InitCharset();
-  void SetChar(int c, const char* c1, const char* c2, const char* c3,
-               const char* c4, const char* c5);
-  void Print(const char* t, int x1, int y1, uint32_t c);
-  void Line(float x1, float y1, float x2, float y2, uint32_t c);
-  void LoadImage(const char* file);
-  void CopyTo(Surface* dst, int x, int y);
-  void Box(int x1, int y1, int x2, int y2, uint32_t color);
-  void Bar(int x1, int y1, int x2, int y2, uint32_t color);
-
-  int width = 0, height = 0;
-  std::vector<uint32_t> pixels;  // rgba
-};
-
 // class Texture {};
 struct Texture {
   explicit Texture(int width, int height, int slot = 0);
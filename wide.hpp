@@ -0,0 +1,209 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <span>
+#include <vector>
+
+#include "base.hpp"
+#include "bvh.hpp"
+#include "simd.hpp"
+
+// node of a Width-ary bvh, the bounds of all children are stored as
+// structure of arrays so a single ray is tested against all of them at once
+template <int Width>
+struct alignas(64) wide_node {
+  std::array<float, Width> min_x, min_y, min_z;
+  std::array<float, Width> max_x, max_y, max_z;
+  // wide node index for inner children, first triangle index for leaves
+  std::array<index_t, Width> child;
+  std::array<index_t, Width> tri_count;  // > 0 for leaves
+  index_t child_count = 0;
+
+  bool is_leaf(int i) const { return tri_count[i] > 0; }
+};
+
+// collapses a built binary bvh into a Width-ary one. Every wide node
+// repeatedly opens its largest inner child until it holds Width children.
+template <int Width>
+struct wide_bvh {
+  static_assert(Width == 4 || Width == 8, "wide bvh supports 4 or 8 lanes");
+
+  template <bvh_strategy Strategy>
+  explicit wide_bvh(const bvh<Strategy>& binary)
+      : triangles(binary.get_mesh()),
+        indices(binary.get_indices().begin(), binary.get_indices().end()),
+        accel(binary.get_accel()) {
+    collapse(binary.get_nodes());
+  }
+
+  void intersect(ray& r) const;
+
+ private:
+  void collapse(std::span<const bvh_node> binary);
+  index_t collapse(std::span<const bvh_node> binary, index_t node_idx);
+
+  mesh_view triangles;
+  std::vector<index_t> indices;
+  std::vector<tri_accel> accel;
+  std::vector<wide_node<Width>> nodes;
+};
+
+using bvh4 = wide_bvh<4>;
+using bvh8 = wide_bvh<8>;
+
+template <int Width>
+void wide_bvh<Width>::collapse(std::span<const bvh_node> binary) {
+  TRACE;
+
+  nodes.clear();
+  nodes.reserve(binary.size() / 2);
+  const bvh_node& root = binary[0];
+  if (root.is_leaf()) {
+    // a single leaf still needs a wide node to hang from
+    auto& node = nodes.emplace_back();
+    node.min_x[0] = root.bounds.min.x;
+    node.min_y[0] = root.bounds.min.y;
+    node.min_z[0] = root.bounds.min.z;
+    node.max_x[0] = root.bounds.max.x;
+    node.max_y[0] = root.bounds.max.y;
+    node.max_z[0] = root.bounds.max.z;
+    node.child[0] = root.first_tri_idx;
+    node.tri_count[0] = root.tri_count;
+    node.child_count = 1;
+    return;
+  }
+  collapse(binary, 0);
+}
+
+template <int Width>
+index_t wide_bvh<Width>::collapse(std::span<const bvh_node> binary,
+                                  index_t node_idx) {
+  // open the inner child with the largest surface area until full
+  std::array<index_t, Width> children{};
+  int count = 0;
+  children[count++] = binary[node_idx].left_node;
+  children[count++] = binary[node_idx].left_node + 1;
+  while (count < Width) {
+    int best = -1;
+    float best_area = -1;
+    for (int i = 0; i < count; ++i) {
+      const auto& child = binary[children[i]];
+      if (!child.is_leaf() && child.bounds.area() > best_area) {
+        best = i;
+        best_area = child.bounds.area();
+      }
+    }
+    if (best < 0) break;
+    index_t opened = binary[children[best]].left_node;
+    children[best] = opened;
+    children[count++] = opened + 1;
+  }
+
+  index_t wide_idx = nodes.size();
+  nodes.emplace_back();
+  // fill in a copy, the recursion below may reallocate nodes
+  wide_node<Width> node;
+  node.child_count = count;
+  for (int i = 0; i < Width; ++i) {
+    node.min_x[i] = node.min_y[i] = node.min_z[i] = 0;
+    node.max_x[i] = node.max_y[i] = node.max_z[i] = 0;
+    node.child[i] = 0;
+    node.tri_count[i] = 0;
+  }
+  for (int i = 0; i < count; ++i) {
+    const auto& child = binary[children[i]];
+    node.min_x[i] = child.bounds.min.x;
+    node.min_y[i] = child.bounds.min.y;
+    node.min_z[i] = child.bounds.min.z;
+    node.max_x[i] = child.bounds.max.x;
+    node.max_y[i] = child.bounds.max.y;
+    node.max_z[i] = child.bounds.max.z;
+    if (child.is_leaf()) {
+      node.child[i] = child.first_tri_idx;
+      node.tri_count[i] = child.tri_count;
+    } else {
+      node.child[i] = collapse(binary, children[i]);
+    }
+  }
+  nodes[wide_idx] = node;
+  return wide_idx;
+}
+
+template <int Width>
+void wide_bvh<Width>::intersect(ray& r) const {
+  using vf = vfloat<Width>;
+  struct entry {
+    index_t node;
+    float dist;
+  };
+  // every visited node pushes at most Width - 1 entries
+  std::array<entry, 64 * (Width - 1)> stack;
+  index_t stack_idx = 0;
+
+  const vf origin_x(r.origin.x), origin_y(r.origin.y), origin_z(r.origin.z);
+  const vf r_dir_x(r.r_direction.x), r_dir_y(r.r_direction.y),
+      r_dir_z(r.r_direction.z);
+  const vf zero(0.0f);
+
+  index_t node_idx = 0;
+  while (true) {
+    const auto& node = nodes[node_idx];
+    BVH_STAT(++r.stats.inner_nodes);
+    BVH_STAT(r.stats.aabb_tests += node.child_count);
+
+    // slab test against all children at once
+    vf tx1 = (vf::load(node.min_x.data()) - origin_x) * r_dir_x;
+    vf tx2 = (vf::load(node.max_x.data()) - origin_x) * r_dir_x;
+    vf ty1 = (vf::load(node.min_y.data()) - origin_y) * r_dir_y;
+    vf ty2 = (vf::load(node.max_y.data()) - origin_y) * r_dir_y;
+    vf tz1 = (vf::load(node.min_z.data()) - origin_z) * r_dir_z;
+    vf tz2 = (vf::load(node.max_z.data()) - origin_z) * r_dir_z;
+    vf tmin = max(max(min(tx1, tx2), min(ty1, ty2)), min(tz1, tz2));
+    vf tmax = min(min(max(tx1, tx2), max(ty1, ty2)), max(tz1, tz2));
+    int mask = ((tmax >= tmin) & (tmin < vf(r.t)) & (tmax > zero)).mask();
+    mask &= (1 << node.child_count) - 1;
+
+    alignas(32) std::array<float, Width> dist;
+    tmin.store(dist.data());
+
+    // leaves are intersected right away, inner children are sorted by
+    // distance and pushed far to near
+    std::array<entry, Width> hits;
+    int hit_count = 0;
+    for (; mask != 0; mask &= mask - 1) {
+      int i = std::countr_zero(static_cast<unsigned>(mask));
+      if (node.is_leaf(i)) {
+        BVH_STAT(++r.stats.leaves);
+        BVH_STAT(r.stats.triangle_tests += node.tri_count[i]);
+        index_t end = node.child[i] + node.tri_count[i];
+        if (!accel.empty()) {
+          for (index_t j = node.child[i]; j < end; ++j) {
+            intersect_tri(accel[j], r);
+          }
+        } else {
+          for (index_t j = node.child[i]; j < end; ++j) {
+            intersect_tri(triangles[indices[j]], r, indices[j]);
+          }
+        }
+      } else {
+        hits[hit_count++] = {node.child[i], dist[i]};
+      }
+    }
+    for (int i = 1; i < hit_count; ++i) {
+      entry e = hits[i];
+      int j = i;
+      for (; j > 0 && hits[j - 1].dist < e.dist; --j) hits[j] = hits[j - 1];
+      hits[j] = e;
+    }
+    for (int i = 0; i < hit_count; ++i) stack[stack_idx++] = hits[i];
+    BVH_STAT(r.stats.max_stack_depth =
+                 std::max(r.stats.max_stack_depth, stack_idx));
+
+    // skip entries that are farther away than the closest hit found since
+    while (stack_idx > 0 && stack[stack_idx - 1].dist >= r.t) --stack_idx;
+    if (stack_idx == 0) break;
+    node_idx = stack[--stack_idx].node;
+  }
+}
\ No newline at end of file